@@ -0,0 +1,119 @@
+#include <cpprelude/IO.h>
+#include <pensieve/Pensieve.h>
+
+#include <chrono>
+#include <stdlib.h>
+#include <stdio.h>
+
+using namespace cppr;
+using namespace pnsv;
+
+constexpr static const char* ARCHIVE_PATH = "benchmark.pnsv";
+
+struct Config
+{
+	usize files_count;
+	usize file_size;
+	//read every nth file so that the reads can't be merged into one sequential read
+	usize stride;
+	usize queue_depth;
+};
+
+static r64
+now_ms()
+{
+	using namespace std::chrono;
+	return duration<r64, std::milli>(high_resolution_clock::now().time_since_epoch()).count();
+}
+
+static void
+generate(const Config& config)
+{
+	Pensieve pn;
+	auto data = alloc<byte>(config.file_size);
+	for(usize i = 0; i < config.file_size; ++i)
+		data.ptr[i] = byte(i * 31);
+
+	char name[64];
+	for(usize i = 0; i < config.files_count; ++i)
+	{
+		snprintf(name, sizeof(name), "/data/%zu", i);
+		IO_Trait* io = pn.file_stream(pn.file_create(name));
+		//distinct content so that the files are not deduplicated
+		vprintb(io, u64(i), data.all());
+	}
+	free(data);
+
+	pn.save_on_disk(ARCHIVE_PATH);
+}
+
+static Dynamic_Array<Virtual_Handle>
+selection(const Pensieve& pn, const Config& config)
+{
+	Dynamic_Array<Virtual_Handle> handles;
+	for(usize i = 0; i < pn.header.files.count(); i += config.stride)
+		handles.insert_back(Virtual_Handle { i });
+	return handles;
+}
+
+static void
+bench_batch(const Config& config)
+{
+	r64 start = now_ms();
+
+	Pensieve pn;
+	if(pn.mount_from_disk(ARCHIVE_PATH) != Pensieve::ERROR_OK)
+		return;
+	bool ok = pn.files_read_batch(selection(pn, config));
+
+	printfmt("files_read_batch: {}ms ok: {}\n", now_ms() - start, ok);
+}
+
+static void
+bench_async(const Config& config, ASYNC_BACKEND backend, const char* name)
+{
+	r64 start = now_ms();
+
+	Async_IO aio(config.queue_depth, backend);
+	if(aio.backend != backend)
+	{
+		printfmt("{}: unavailable\n", name);
+		return;
+	}
+
+	Pensieve pn;
+	if(pn.mount_from_disk(ARCHIVE_PATH) != Pensieve::ERROR_OK)
+		return;
+
+	bool ok = false;
+	pn.read_async(aio, selection(pn, config), [](Pensieve*, bool result, void* user_data){
+		*static_cast<bool*>(user_data) = result;
+	}, &ok);
+	aio.wait_all();
+
+	printfmt("{}: {}ms ok: {}\n", name, now_ms() - start, ok);
+}
+
+i32
+main(i32 argc, char** argv)
+{
+	Config config{};
+	config.files_count = argc > 1 ? usize(atoll(argv[1])) : 1024;
+	config.file_size = argc > 2 ? usize(atoll(argv[2])) : 64 * 1024;
+	config.stride = argc > 3 ? usize(atoll(argv[3])) : 4;
+	config.queue_depth = argc > 4 ? usize(atoll(argv[4])) : 64;
+
+	printfmt("files: {}, file size: {}, stride: {}, queue depth: {}\n",
+			 config.files_count, config.file_size, config.stride, config.queue_depth);
+
+	generate(config);
+
+	//the first pass warms the page cache so that all the runs see the same state
+	bench_batch(config);
+	bench_batch(config);
+	bench_async(config, ASYNC_BACKEND_BLOCKING, "async blocking");
+	bench_async(config, ASYNC_BACKEND_IO_URING, "async io_uring");
+
+	::remove(ARCHIVE_PATH);
+	return 0;
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "pensieve/Exports.h"
+#include "pensieve/Disk.h"
+
+#include <cpprelude/Dynamic_Array.h>
+
+namespace pnsv
+{
+	using namespace cppr;
+
+	struct Async_Request;
+
+	using Async_Callback = void(*)(Async_Request* request);
+
+	/**
+	 * A single positional read or write
+	 * the request and its data should stay alive until its callback is called
+	 */
+	struct Async_Request
+	{
+		Disk_File file;
+		u64 offset;
+		Slice<byte> data;
+		bool write;
+
+		//number of bytes transferred, it's set before the callback is called
+		usize result;
+
+		Async_Callback callback;
+		void* user_data;
+	};
+
+	enum ASYNC_BACKEND
+	{
+		ASYNC_BACKEND_BLOCKING,
+		ASYNC_BACKEND_IO_URING
+	};
+
+	/**
+	 * Async_IO queues reads and writes and completes them through their callbacks
+	 * on linux it uses io_uring to keep many requests in flight from one thread
+	 * when io_uring isn't available it falls back to blocking reads and writes which are
+	 * executed when the queue is polled
+	 * callbacks are always called from poll, wait or wait_all never from submit
+	 * empty requests complete on the next poll without any io
+	 * when the io_uring ring breaks its requests in flight are cancelled and fail with their partial result
+	 * once the kernel is done with them, and the queue falls back to blocking io
+	 */
+	struct Async_IO
+	{
+		ASYNC_BACKEND backend;
+		usize queue_depth;
+		usize in_flight;
+
+		//blocking backend queue and the overflow of a full ring
+		Dynamic_Array<Async_Request*> _pending;
+		//requests which complete on the next poll without io
+		Dynamic_Array<Async_Request*> _ready;
+		//io_uring backend state
+		void* _ring;
+
+		API_PNSV explicit
+		Async_IO(usize queue_depth = 64, ASYNC_BACKEND preferred = ASYNC_BACKEND_IO_URING);
+
+		Async_IO(const Async_IO&) = delete;
+
+		Async_IO&
+		operator=(const Async_IO&) = delete;
+
+		API_PNSV
+		~Async_IO();
+
+		API_PNSV void
+		submit(Async_Request* request);
+
+		//completes the finished requests without blocking and returns their count
+		API_PNSV usize
+		poll();
+
+		//blocks until at least one request completes and returns the completed count
+		API_PNSV usize
+		wait();
+
+		API_PNSV void
+		wait_all();
+	};
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include "pensieve/Exports.h"
+#include "pensieve/Disk.h"
+
+#include <cpprelude/Dynamic_Array.h>
+
+#include <atomic>
+#include <mutex>
+
+namespace pnsv
+{
+	using namespace cppr;
+
+	struct Block_Cache_Stats
+	{
+		u64 hits;
+		u64 misses;
+		u64 evictions;
+		//count of the blocks which are in the cache now
+		usize blocks_count;
+	};
+
+	/**
+	 * Block_Cache keeps fixed size blocks of archive files in a fixed memory budget
+	 * the blocks are keyed by (archive, block) and evicted using the CLOCK policy
+	 * it's safe to share one cache between multiple archives and threads
+	 * it serves the range reads of file_read, whole files are fetched with big coalesced reads which bypass it
+	 * so a batch load doesn't flush the hot blocks out of the cache
+	 */
+	struct Block_Cache
+	{
+		constexpr static usize DEFAULT_BLOCK_SIZE = 64ULL * 1024ULL;
+
+		struct Slot
+		{
+			u64 archive;
+			u64 block;
+			//the block could be shorter than block_size at the end of the file
+			usize size;
+			//next slot in the same bucket
+			usize next;
+			bool used;
+			bool referenced;
+			//a miss is reading the block into this slot
+			bool loading;
+		};
+
+		usize block_size;
+		Owner<byte> _memory;
+		Dynamic_Array<Slot> _slots;
+		//heads of the buckets chains
+		Dynamic_Array<usize> _buckets;
+		usize _hand;
+		mutable std::mutex _mutex;
+
+		std::atomic<u64> _hits;
+		std::atomic<u64> _misses;
+		std::atomic<u64> _evictions;
+
+		//the budget is rounded down to whole blocks with at least one block
+		API_PNSV explicit
+		Block_Cache(usize memory_budget, usize block_size = DEFAULT_BLOCK_SIZE);
+
+		Block_Cache(const Block_Cache&) = delete;
+
+		Block_Cache&
+		operator=(const Block_Cache&) = delete;
+
+		API_PNSV
+		~Block_Cache();
+
+		/**
+		 * Reads data at the given offset of the file through the cache
+		 * archive is a unique id of the file content, see archive_id_new
+		 * returns the count of bytes read which is less than data.size only at the end of the file or on errors
+		 */
+		API_PNSV usize
+		read(u64 archive, Disk_File file, u64 offset, Slice<byte> data);
+
+		API_PNSV Block_Cache_Stats
+		stats() const;
+
+		//drops all the blocks of the given archive
+		API_PNSV void
+		evict(u64 archive);
+
+		//takes the slot which the next miss is read into, usize(-1) when all of them are being filled
+		API_PNSV usize
+		_victim();
+
+		API_PNSV usize
+		_find(u64 archive, u64 block) const;
+
+		API_PNSV void
+		_unlink(usize slot);
+	};
+
+	//every mounted archive gets a new id so the blocks of an overwritten file are never reused
+	API_PNSV u64
+	archive_id_new();
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "pensieve/Exports.h"
+#include "pensieve/Pensieve.h"
+
+namespace pnsv
+{
+	using namespace cppr;
+
+	/**
+	 * A patch turns one version of an archive into the next one
+	 * the entries are matched by path and content hash confirmed byte by byte, the modified entries are stored as block deltas of their old content
+	 * the patch is read front to back in one pass, the new and modified contents are spooled to a file beside the new archive
+	 * and streamed into it, so the memory use doesn't depend on the size of the changes
+	 * the new archive is read back and checked against the checksum of the archive the patch was made from
+	 *
+	 * Patch file layout:
+	 * Address Size Description
+	 * +00 4 Magic number
+	 * +04 2 Major version
+	 * +06 2 Minor version
+	 * +08 8 Size of the old archive file
+	 * +16 8 Hash of the old archive header
+	 * +24 4 Count of the entries of the new archive
+	 * +28 List of the entries
+	 * 	+00 2 path length
+	 * 	+02 N path
+	 * 	+02+N 1 flags
+	 * 	+03+N 8 modification time
+	 * 	+11+N 1 tags length
+	 * 	+12+N T tags
+	 * 	+12+N+T 1 op
+	 * 	DELTA_OP_KEEP the old entry with the same path is unchanged
+	 * 	DELTA_OP_COPY 2 path length, N path of the old entry with the same content
+	 * 	DELTA_OP_DATA 8 size, M content
+	 * 	DELTA_OP_DELTA 2 path length, N path of the old entry which is the base, 8 size, then the instructions
+	 * 		1 DELTA_INST_COPY, 8 offset in the base, 4 size
+	 * 		1 DELTA_INST_LITERAL, 4 size, M bytes
+	 * 		1 DELTA_INST_END
+	 * XX 4 CRC32 of the paths and contents of the new archive entries in their order, since minor version 1
+	 * XX+4 4 CRC32 from the major version to the end of the previous field
+	 */
+	constexpr static u32 PATCH_MAGIC = 0x33D9AFF0;
+	constexpr static u16 PATCH_MAJOR = u16(1);
+	constexpr static u16 PATCH_MINOR = u16(1);
+
+	constexpr static u8 DELTA_OP_KEEP = 0;
+	constexpr static u8 DELTA_OP_COPY = 1;
+	constexpr static u8 DELTA_OP_DATA = 2;
+	constexpr static u8 DELTA_OP_DELTA = 3;
+
+	constexpr static u8 DELTA_INST_END = 0;
+	constexpr static u8 DELTA_INST_COPY = 1;
+	constexpr static u8 DELTA_INST_LITERAL = 2;
+
+	struct Delta_Stats
+	{
+		usize kept;
+		usize copied;
+		usize added;
+		usize deltas;
+		//count of the bytes which the deltas take from their old entries
+		u64 reused_bytes;
+		u64 literal_bytes;
+	};
+
+	//writes the patch which turns the old archive into the new one
+	API_PNSV bool
+	archive_diff(const char* old_path, const char* new_path, const char* patch_path, Delta_Stats* stats = nullptr);
+
+	//writes the new archive from the old one and the patch, fails if the patch was made for another old archive
+	API_PNSV bool
+	archive_patch(const char* old_path, const char* patch_path, const char* new_path);
+
+	/**
+	 * Writes the delta instructions which build data from base
+	 * the base is split into blocks of block_size and the blocks found in data using a rolling hash are copied instead of stored
+	 */
+	API_PNSV void
+	delta_encode(File_View<byte> base, File_View<byte> data, usize block_size, IO_Trait* io, Delta_Stats* stats = nullptr);
+}
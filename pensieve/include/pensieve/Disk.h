@@ -0,0 +1,52 @@
+#pragma once
+
+#include "pensieve/Exports.h"
+
+#include <cpprelude/defines.h>
+#include <cpprelude/File.h>
+
+namespace pnsv
+{
+	using namespace cppr;
+
+	/**
+	 * Disk_File is a thin os file handle which only does positional reads and writes
+	 * it has no cursor so multiple reads can target the same file at different offsets
+	 */
+	struct Disk_File
+	{
+		isize handle;
+
+		bool
+		valid() const
+		{
+			return handle != isize(-1);
+		}
+	};
+	constexpr static Disk_File INVALID_DISK_FILE { isize(-1) };
+
+	//IO_MODE::READ opens an existing file, IO_MODE::WRITE creates or truncates the file
+	API_PNSV Disk_File
+	disk_open(const char* path, IO_MODE mode);
+
+	API_PNSV void
+	disk_close(Disk_File& file);
+
+	API_PNSV u64
+	disk_size(Disk_File file);
+
+	//moves the file over the destination replacing it if it exists
+	API_PNSV bool
+	disk_rename(const char* from, const char* to);
+
+	API_PNSV bool
+	disk_remove(const char* path);
+
+	//returns the number of bytes read, which is less than data.size only at the end of the file or on errors
+	API_PNSV usize
+	disk_read_at(Disk_File file, u64 offset, Slice<byte> data);
+
+	//returns the number of bytes written, which is less than data.size only on errors
+	API_PNSV usize
+	disk_write_at(Disk_File file, u64 offset, Slice<byte> data);
+}
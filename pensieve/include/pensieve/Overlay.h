@@ -0,0 +1,71 @@
+#pragma once
+
+#include "pensieve/Exports.h"
+#include "pensieve/Pensieve.h"
+
+namespace pnsv
+{
+	using namespace cppr;
+
+	struct Overlay_Handle
+	{
+		usize layer;
+		Virtual_Handle handle;
+
+		bool
+		valid() const
+		{
+			return layer != usize(-1) && handle.valid();
+		}
+	};
+	constexpr static Overlay_Handle INVALID_OVERLAY_HANDLE { usize(-1), INVALID_FILE_HANDLE };
+
+	/**
+	 * Overlay stacks a base archive and patch archives without merging them
+	 * every layer is mounted lazily so only the headers are read at startup
+	 * lookups resolve to the topmost layer which has the path and whiteout entries hide the lower layers
+	 * the file content is read from the layer which owns the entry
+	 */
+	struct Overlay
+	{
+		//layers[0] is the base and the last layer is the topmost patch
+		Dynamic_Array<Pensieve> layers;
+
+		//mounts the archive on top of the current layers
+		API_PNSV Pensieve::ERROR_CODE
+		mount(const char* path);
+
+		API_PNSV Overlay_Handle
+		file_open(const String& path);
+
+		API_PNSV bool
+		file_exists(const String& path) const;
+
+		API_PNSV const String&
+		file_name(Overlay_Handle handle) const;
+
+		API_PNSV u64
+		file_size(Overlay_Handle handle) const;
+
+		API_PNSV File_Stat
+		file_stat(Overlay_Handle handle) const;
+
+		//fetches the file content from its layer if it's not in memory yet
+		API_PNSV Memory_Stream&
+		file_stream(Overlay_Handle handle);
+
+		API_PNSV usize
+		file_read(Overlay_Handle handle, u64 offset, Slice<byte> data) const;
+
+		//returns the visible files ordered by their path
+		API_PNSV Dynamic_Array<Overlay_Handle>
+		files_match(const String& pattern) const;
+
+		//fetches the given files with one batch per layer
+		API_PNSV bool
+		files_read_batch(const Dynamic_Array<Overlay_Handle>& handles);
+
+		API_PNSV Overlay_Handle
+		_file_lookup(const String& path) const;
+	};
+}
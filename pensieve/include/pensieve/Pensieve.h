@@ -1,6 +1,11 @@
 #pragma once
 
 #include "pensieve/Exports.h"
+#include "pensieve/Disk.h"
+#include "pensieve/Async_IO.h"
+#include "pensieve/Block_Cache.h"
+#include "pensieve/Volume_Set.h"
+#include "pensieve/Thread_Pool.h"
 
 #include <cpprelude/IO_Trait.h>
 #include <cpprelude/Dynamic_Array.h>
@@ -8,6 +13,7 @@
 #include <cpprelude/Memory_Stream.h>
 
 #include <assert.h>
+#include <type_traits>
 
 namespace pnsv
 {
@@ -27,31 +33,164 @@ namespace pnsv
 	 * +00 4 Magic number
 	 * +04 2 Major version
 	 * +06 2 Minor version
-	 * +12 8 Length of the data
-	 * +20 4 Count of the files in the system
-	 * +24 List of files in the system
-	 * 	+24 2 filename length
-	 * 	+26 N filename
-	 * 	+26+N 8 offset of the file measured from the start of the data
-	 * +08 4 CRC32 starting from `(+06) data length` to this byte
+	 * +08 8 Length of the data
+	 * +16 4 Count of the files in the system
+	 * +20 List of files in the system
+	 * 	+20 2 filename length
+	 * 	+22 N filename
+	 * 	+22+N 8 offset of the file measured from the start of the data
+	 * XX 4 CRC32 starting from `(+08) data length` to this byte
 	 * START OF DATA
 	 * +00 8 binary content size in bytes
 	 * +08 N binary content
+	 *
+	 * Version 2.0:
+	 * Same layout as version 1, files with byte identical content share one chunk
+	 * so multiple files could have the same offset and the chunks count could be less than the files count
+	 * the data length is the sum of the unique chunks sizes
+	 *
+	 * Version 3.0:
+	 * Every file entry has a flags byte after the filename
+	 * 	+22+N 1 flags
+	 * 	if ENTRY_FLAG_INLINE is set the content is stored in the header instead of the offset
+	 * 	+23+N 4 content size
+	 * 	+27+N M content
+	 * 	otherwise
+	 * 	+23+N 8 offset of the file measured from the start of the data
+	 *
+	 * Version 3.1:
+	 * ENTRY_FLAG_WHITEOUT marks an empty entry which hides the file with the same path in the lower overlay layers
+	 *
+	 * Version 4.0:
+	 * Every file entry has its metadata after the flags byte then the inline content or the offset as in version 3
+	 * 	+23+N 8 content size in bytes
+	 * 	+31+N 8 modification time in seconds since the unix epoch
+	 * 	+39+N 1 tags length
+	 * 	+40+N T tags
+	 *
+	 * Version 4.1:
+	 * ENTRY_FLAG_TABLE marks a file whose content is a columnar table, see Table.h
 	 */
 
 	constexpr static u32 MAGIC = 0x33D9AFEE;
-	constexpr static u16 MAJOR = u16(1);
-	constexpr static u16 MINOR = u16(0);
+	constexpr static u16 MAJOR = u16(4);
+	constexpr static u16 MINOR = u16(1);
 
 	struct File_Header_Entry
 	{
 		String 	name;
 		usize 	index;
+		//ENTRY_FLAG_* which are kept in memory, the inline flag is only decided on save
+		u8 		flags;
+		//seconds since the unix epoch
+		u64 	mtime;
+		//small user data, at most MAX_TAGS_SIZE bytes
+		String 	tags;
 	};
 
+	constexpr static usize MAX_TAGS_SIZE = 255;
+
+	//the entry metadata which is available from the header without the file content
+	struct File_Stat
+	{
+		u64 size;
+		u64 mtime;
+		u8 flags;
+		//points to the entry tags, it's valid until the next file_set_tags or the removal of the file
+		String_Range tags;
+	};
+
+	//reads which are at most this far apart on disk are merged into a single read
+	constexpr static u64 BATCH_GAP_SIZE = 64ULL * 1024ULL;
+	//merged reads don't grow beyond this size unless a single chunk is bigger
+	constexpr static u64 BATCH_SPAN_SIZE = 8ULL * 1024ULL * 1024ULL;
+	//files which are at most this size are stored inline in the header by default
+	constexpr static u32 DEFAULT_INLINE_THRESHOLD = 64;
+
+	constexpr static u8 ENTRY_FLAG_INLINE = 0x01;
+	constexpr static u8 ENTRY_FLAG_WHITEOUT = 0x02;
+	constexpr static u8 ENTRY_FLAG_TABLE = 0x04;
+
+	//chunks which are not in memory are copied through a buffer of this size on save
+	constexpr static u64 STREAM_BUFFER_SIZE = 1024ULL * 1024ULL;
+
 	struct File_Content
 	{
 		Memory_Stream bin;
+		//offset of the chunk measured from the start of the data, only valid for content read from disk
+		u64 offset;
+		//size of the chunk binary content in bytes, only valid when offset is valid
+		u64 size;
+		//the binary content is still on disk and should be fetched before use
+		bool lazy;
+		//the binary content is streamed from this source on save, size is the count of bytes it provides
+		IO_Trait* source;
+		//the binary content is saved directly from this memory, size is its count of bytes
+		const byte* external;
+		//set when the external memory is adopted, it's freed with the content
+		Owner<byte> owned;
+		//count of the header entries which share this content
+		usize refs;
+	};
+
+	/**
+	 * A read only array of T over the file content without any copies
+	 * it's valid until the file is changed, removed or the pensieve is destroyed
+	 */
+	template<typename T>
+	struct File_View
+	{
+		const T* ptr;
+		usize count;
+		//set when the bytes couldn't be viewed, which tells the failure apart from an empty file
+		bool _failed = false;
+
+		const T*
+		begin() const
+		{
+			return ptr;
+		}
+
+		const T*
+		end() const
+		{
+			return ptr + count;
+		}
+
+		const T&
+		operator[](usize index) const
+		{
+			assert(index < count);
+			return ptr[index];
+		}
+
+		bool
+		empty() const
+		{
+			return count == 0;
+		}
+
+		bool
+		valid() const
+		{
+			return _failed == false;
+		}
+	};
+
+	struct Pensieve_Stats
+	{
+		u64 files_count;
+		u64 chunks_count;
+		//size of the files content as seen by the user
+		u64 logical_size;
+		//size of the unique chunks which are stored
+		u64 stored_size;
+
+		r64
+		dedup_ratio() const
+		{
+			return stored_size ? r64(logical_size) / r64(stored_size) : 1.0;
+		}
 	};
 
 	struct Virtual_Handle
@@ -77,6 +216,14 @@ namespace pnsv
 
 	API_PNSV u32
 	crc32_slurp(u32 current_value, const void* ptr, usize size);
+
+	//fast non cryptographic 64-bit hash (xxhash64)
+	API_PNSV u64
+	hash64(const void* ptr, usize size, u64 seed = 0);
+
+	//orders the names by their bytes, the delta and overlay entries are merged in this order
+	API_PNSV bool
+	_name_less(const String& a, const String& b);
 	
 	struct Header
 	{
@@ -102,6 +249,57 @@ namespace pnsv
 		files_match(const String& pattern) const;
 	};
 
+	/**
+	 * Access_Trace records the order in which the files are first opened
+	 * it's saved next to the app and used on the next archive save to lay out the chunks in that order
+	 * so the cold start reads become mostly sequential
+	 */
+	struct Access_Trace
+	{
+		struct Seen_Slot
+		{
+			u64 hash;
+			//index of the path in paths, usize(-1) is the empty slot
+			usize path;
+		};
+
+		Dynamic_Array<String> paths;
+		//open addressing set of the recorded paths
+		Dynamic_Array<Seen_Slot> _seen;
+
+		//only the first access of every path is recorded, the file_open of archives, overlays and vfs record their hits
+		API_PNSV void
+		record(const String& path);
+
+		API_PNSV void
+		clear();
+
+		API_PNSV bool
+		save_to_disk(const char* path) const;
+
+		API_PNSV bool
+		load_from_disk(const char* path);
+
+		//returns false when the path is already recorded, otherwise it takes the slot of the next path
+		API_PNSV bool
+		_seen_insert(const String& path, u64 hash);
+	};
+
+	/**
+	 * Reads the signature and the header of an archive file in one read
+	 * the block could have the start of the chunks after the header
+	 */
+	API_PNSV bool
+	archive_header_read(Disk_File file, Memory_Stream& block);
+
+	API_PNSV bool
+	archive_header_read(const Volume_Set& volumes, Memory_Stream& block);
+
+	struct Pensieve;
+	struct Pensieve_Task;
+
+	using Pensieve_Callback = void(*)(Pensieve* pensieve, bool ok, void* user_data);
+
 	struct Pensieve
 	{
 		enum ERROR_CODE
@@ -111,11 +309,46 @@ namespace pnsv
 			ERROR_FILE_CORRUPTED,
 			ERROR_NOT_PNSV_FILE,
 			ERROR_INCOMPATIBLE_MAJOR_VERSION,
-			ERROR_HEADER_CORRUPTED
+			ERROR_HEADER_CORRUPTED,
+			ERROR_CANCELLED,
+			ERROR_WRITE_FAILED
 		};
 
 		Header header;
 		Dynamic_Array<File_Content> content;
+		//the mounted archive file which lazy content is fetched from
+		Disk_File disk;
+		//when set the lazy content is fetched from these volumes instead of the disk file
+		Volume_Set* volumes;
+		//offset of the start of the binary chunks section in the mounted file
+		u64 data_offset;
+		//files which are at most this size are saved inline in the header, so they are loaded with it
+		u32 inline_threshold;
+		//optional shared cache which file_read goes through for lazy content
+		Block_Cache* cache;
+		//id of the mounted file content in the cache
+		u64 archive_id;
+		//when set every opened file is recorded into it
+		Access_Trace* trace;
+		//when set the chunks of the traced files are saved first in the trace order
+		const Access_Trace* layout;
+
+		API_PNSV
+		Pensieve();
+
+		Pensieve(const Pensieve&) = delete;
+
+		Pensieve&
+		operator=(const Pensieve&) = delete;
+
+		API_PNSV
+		Pensieve(Pensieve&& other);
+
+		API_PNSV Pensieve&
+		operator=(Pensieve&& other);
+
+		API_PNSV
+		~Pensieve();
 
 		API_PNSV Virtual_Handle
 		file_create_open(const String& path);
@@ -123,6 +356,36 @@ namespace pnsv
 		API_PNSV Virtual_Handle
 		file_create(const String& path);
 
+		/**
+		 * Creates a file whose content is streamed from the source when the archive is saved
+		 * so files bigger than the memory could be written through a small buffer
+		 * the source should stay alive and provide size bytes until the save which consumes it
+		 */
+		API_PNSV Virtual_Handle
+		file_create_from_stream(const String& path, IO_Trait* source, u64 size);
+
+		/**
+		 * Creates a file which takes the buffer as its content without copying it
+		 * the archive is saved directly from the buffer which is freed with the file
+		 */
+		API_PNSV Virtual_Handle
+		file_create_from(const String& path, Owner<byte>&& buffer);
+
+		/**
+		 * Creates a file which references the memory without copying it
+		 * the memory should stay alive until save_on_disk mounts the new archive or the file is removed
+		 */
+		API_PNSV Virtual_Handle
+		file_create_borrowed(const String& path, const byte* data, usize size);
+
+		//creates an entry which deletes the path from the lower layers when this archive is an overlay patch
+		//the entry is hidden from file_open, file_exists and files_match and a file created on its path replaces it
+		API_PNSV Virtual_Handle
+		file_whiteout(const String& path);
+
+		API_PNSV bool
+		file_is_whiteout(Virtual_Handle handle) const;
+
 		API_PNSV Virtual_Handle
 		file_open(const String& path);
 
@@ -132,12 +395,85 @@ namespace pnsv
 		API_PNSV const String&
 		file_name(Virtual_Handle handle) const;
 
+		//lazy content can't be fetched through the const stream, use files_read_batch first
 		API_PNSV const Memory_Stream&
 		file_stream(Virtual_Handle handle) const;
 
+		//fetches lazy content and asserts that it succeeded, use files_read_batch first to handle the io errors
+		//a failed fetch leaves the file empty so the writes to the stream aren't lost
+		//the stream is handed out for writing so the file mtime is set to now, like file_write and file_clear do
 		API_PNSV Memory_Stream&
 		file_stream(Virtual_Handle handle);
 
+		API_PNSV u64
+		file_size(Virtual_Handle handle) const;
+
+		API_PNSV File_Stat
+		file_stat(Virtual_Handle handle) const;
+
+		API_PNSV void
+		file_set_mtime(Virtual_Handle handle, u64 mtime);
+
+		//the tags are truncated to MAX_TAGS_SIZE bytes
+		API_PNSV void
+		file_set_tags(Virtual_Handle handle, const String& tags);
+
+		/**
+		 * Reads a range of the file content without fetching the whole file
+		 * lazy files are read directly from the mounted archive, streamed files can't be read before saving
+		 * returns the count of bytes read which is less than data.size at the end of the file
+		 */
+		API_PNSV usize
+		file_read(Virtual_Handle handle, u64 offset, Slice<byte> data) const;
+
+		/**
+		 * Returns the file content as an array of T, lazy and streamed files are fetched first
+		 * the view is empty and not valid if the file size isn't a multiple of sizeof(T), the data isn't aligned for T
+		 * or the fetch failed, an empty file gives a valid empty view
+		 */
+		template<typename T>
+		File_View<T>
+		file_view(Virtual_Handle handle)
+		{
+			static_assert(std::is_trivially_copyable<T>::value, "file_view needs a trivially copyable type");
+			return _view_bytes<T>(_file_bytes(handle));
+		}
+
+		/**
+		 * Appends count values of T to the end of the file with a single copy
+		 * the stream cursor is left at the end of the file
+		 */
+		template<typename T>
+		void
+		file_write(Virtual_Handle handle, const T* data, usize count)
+		{
+			static_assert(std::is_trivially_copyable<T>::value, "file_write needs a trivially copyable type");
+			_file_append(handle, data, count * sizeof(T));
+		}
+
+		template<typename T>
+		void
+		file_write(Virtual_Handle handle, File_View<T> data)
+		{
+			file_write(handle, data.ptr, data.count);
+		}
+
+		/**
+		 * Grows the file by the given count of zeroed bytes and returns them to be filled in place
+		 * the region is valid until the file is written again
+		 */
+		API_PNSV Slice<byte>
+		file_append_reserve(Virtual_Handle handle, usize bytes);
+
+		//same as file_view but lazy and streamed files give an empty view which isn't valid
+		template<typename T>
+		File_View<T>
+		file_view(Virtual_Handle handle) const
+		{
+			static_assert(std::is_trivially_copyable<T>::value, "file_view needs a trivially copyable type");
+			return _view_bytes<T>(_file_bytes(handle));
+		}
+
 		API_PNSV bool
 		file_exists(const String& path) const;
 
@@ -150,22 +486,256 @@ namespace pnsv
 		API_PNSV Dynamic_Array<Virtual_Handle>
 		files_match(const String& pattern) const;
 
+		/**
+		 * Fetches the content of the given files from the mounted archive
+		 * the reads are sorted by their disk offset and the nearby chunks are merged
+		 * into one big read which is then split into the per file streams
+		 * files which are already in memory are skipped
+		 */
+		API_PNSV bool
+		files_read_batch(const Dynamic_Array<Virtual_Handle>& handles);
+
+		//fetches the traced files in one batch, with a layout saved from the same trace this is a few sequential reads
+		API_PNSV bool
+		files_prefetch(const Access_Trace& trace);
+
+		/**
+		 * Queues the coalesced reads of the given files on the async io
+		 * the callback is called from the async io once all of them are fetched, even when there's nothing to read
+		 * the files shouldn't be used until then
+		 */
+		API_PNSV void
+		read_async(Async_IO& aio, const Dynamic_Array<Virtual_Handle>& handles,
+				   Pensieve_Callback callback, void* user_data);
+
 		API_PNSV u64
 		total_data_size() const;
 
-		API_PNSV void
+		API_PNSV Pensieve_Stats
+		stats() const;
+
+		//lazy files are copied through a small buffer, streamed files are read into memory first since the stream isn't mounted
+		API_PNSV bool
 		save_to_stream(IO_Trait* io);
 
+		/**
+		 * Saves the archive, the new file is written beside the target then moved over it so a failed save leaves it untouched
+		 * afterwards the archive is mounted on the new file and the lazy and streamed files are read from it
+		 */
 		API_PNSV bool
 		save_on_disk(const char* path);
 
+		//writes the header and every chunk as separate async writes, the callback is called when all of them are done
+		//like save_on_disk they go to the path with .tmp appended which is moved over the target only when they all succeed
+		//all the files content is fetched into memory first
+		API_PNSV bool
+		save_async(Async_IO& aio, const char* path, Pensieve_Callback callback, void* user_data);
+
 		API_PNSV ERROR_CODE
 		load_from_stream(IO_Trait* io);
 
 		API_PNSV ERROR_CODE
 		load_from_disk(const char* path);
 
+		/**
+		 * Loads only the header and keeps the file open
+		 * the files content is fetched from the disk when it's first used
+		 */
+		API_PNSV ERROR_CODE
+		mount_from_disk(const char* path);
+
+		/**
+		 * Saves the archive striped over the given volumes which should be created for writing
+		 * the archive stays mounted where it was, and the streamed files are kept in memory
+		 */
+		API_PNSV bool
+		save_on_volumes(Volume_Set& volumes);
+
+		API_PNSV ERROR_CODE
+		load_from_volumes(Volume_Set& volumes);
+
+		//like mount_from_disk, the volumes should stay open while the archive is mounted on them
+		API_PNSV ERROR_CODE
+		mount_from_volumes(Volume_Set& volumes);
+
+		//mounts the header then queues the reads of all the files content
+		API_PNSV ERROR_CODE
+		load_async(Async_IO& aio, const char* path, Pensieve_Callback callback, void* user_data);
+
+		//a structural check which reads every chunk of the mounted archive which is still on disk
+		//and compares its size prefix with the header, the content itself isn't checked and the resident files are skipped
+		API_PNSV ERROR_CODE
+		verify();
+
+		/**
+		 * Task based variants which run on the shared thread pool, or on the calling thread when there's none
+		 * the chunks are read in parallel spans, one task per span
+		 * the task should stay alive until it's done and the archive shouldn't be used meanwhile
+		 * a cancelled load keeps the archive mounted so the files which weren't fetched yet are read lazily
+		 * unless another archive was already mounted, then the loaded entries are dropped and that archive is kept
+		 * a load which fails drops the entries it added
+		 * a save which already started writes to the end so the file on disk is never left half written
+		 */
+		API_PNSV void
+		load_from_disk_async(Pensieve_Task& task, const char* path);
+
+		API_PNSV void
+		save_on_disk_async(Pensieve_Task& task, const char* path);
+
+		API_PNSV void
+		verify_async(Pensieve_Task& task);
+
+		API_PNSV u64
+		_write_header(IO_Trait* io, Dynamic_Array<usize>& chunks, Dynamic_Array<u64>& offsets);
+
+		//writes the chunks after the header which is already in the block, the small chunks are gathered in the block too
+		API_PNSV bool
+		_write_chunks(IO_Trait* io, Memory_Stream& block, const Dynamic_Array<usize>& chunks);
+
+		API_PNSV bool
+		_write_chunk(IO_Trait* io, usize content_index, Owner<byte>& buffer);
+
+		API_PNSV u64
+		_content_size(usize content_index) const;
+
+		API_PNSV bool
+		_content_pipe_source(usize content_index);
+
+		//copies the external memory into the content stream
+		API_PNSV void
+		_content_copy_external(usize content_index);
+
+		API_PNSV void
+		_content_drop_external(usize content_index);
+
+		API_PNSV ERROR_CODE
+		_load_chunks(IO_Trait* io, usize first_chunk);
+
+		API_PNSV ERROR_CODE
+		_load_signature(IO_Trait* io, u16& major, u16& minor);
+
+		API_PNSV ERROR_CODE
+		_load_header(IO_Trait* io, u16 major, u64& data_length, u64& header_size, usize& first_chunk);
+
+		//decodes the header block of a mounted file with the given size and marks its chunks lazy
+		API_PNSV ERROR_CODE
+		_mount_header(Memory_Stream& block, u64 file_size);
+
+		//reads from the mounted disk file or volumes at the given offset
+		API_PNSV usize
+		_data_read(u64 offset, Slice<byte> data) const;
+
+		API_PNSV usize
+		_content_create();
+
+		API_PNSV void
+		_content_release(usize content_index);
+
+		API_PNSV usize
+		_file_detach(Virtual_Handle handle, bool keep_data);
+
+		//points the files with equal bytes to one content and compacts the array, the unique chunks are returned in order
+		API_PNSV void
+		_dedup_contents(Dynamic_Array<usize>& chunks);
+
+		//drops the released contents and renumbers the files contents
+		API_PNSV void
+		_compact_contents();
+
+		//drops the entries and contents which a failed load added after the given counts
+		API_PNSV void
+		_load_rollback(usize first_file, usize first_content);
+
+		//closes the mounted disk file unless an entry is still read lazily from it
+		API_PNSV void
+		_disk_release();
+
+		//moves the chunks of the layout files to the front in the layout order
+		API_PNSV void
+		_layout_chunks(Dynamic_Array<usize>& chunks) const;
+
+		//returns the handles of the trace paths which exist in the header in the trace order
+		API_PNSV Dynamic_Array<Virtual_Handle>
+		_trace_handles(const Access_Trace& trace) const;
+
+		API_PNSV File_View<byte>
+		_file_bytes(Virtual_Handle handle);
+
+		//appends size bytes to the end of the file, null data appends zeros, returns the start of the appended bytes
+		API_PNSV byte*
+		_file_append(Virtual_Handle handle, const void* data, usize size);
+
+		API_PNSV File_View<byte>
+		_file_bytes(Virtual_Handle handle) const;
+
+		//the resident bytes of the content, empty for lazy and streamed content
+		API_PNSV File_View<byte>
+		_content_bytes(usize content_index) const;
+
+		template<typename T>
+		static File_View<T>
+		_view_bytes(File_View<byte> bytes)
+		{
+			if(bytes._failed || bytes.count % sizeof(T) != 0 || usize(bytes.ptr) % alignof(T) != 0)
+				return File_View<T>{ nullptr, 0, true };
+			return File_View<T>{ reinterpret_cast<const T*>(bytes.ptr), bytes.count / sizeof(T) };
+		}
+
+		API_PNSV bool
+		_content_fetch(Dynamic_Array<usize>& indices);
+
+		//reads the spans of the chunks on the thread pool, verify only checks the chunks without keeping them
 		API_PNSV ERROR_CODE
-		_load_version_1(IO_Trait* io);
+		_content_fetch_parallel(Dynamic_Array<usize>& indices, const Pensieve_Task* task, bool verify);
+
+		API_PNSV bool
+		_file_fetch(usize content_index);
+
+		API_PNSV bool
+		_fetch_all();
+	};
+
+	/**
+	 * An async operation of a pensieve, it works as a future through wait and as a callback through callback
+	 * the callback is called on the thread which finished the operation before the waiters are woken up
+	 */
+	struct Pensieve_Task
+	{
+		Pensieve* pensieve;
+		String path;
+		Pensieve::ERROR_CODE error;
+		Task_Group group;
+		//the pool which runs the operation, it's woken when the operation is done
+		Thread_Pool* pool;
+		std::atomic<bool> cancelled;
+		std::atomic<bool> done;
+		std::mutex mutex;
+		std::condition_variable finished;
+
+		Pensieve_Callback callback;
+		void* user_data;
+
+		API_PNSV explicit
+		Pensieve_Task(Pensieve_Callback callback = nullptr, void* user_data = nullptr);
+
+		Pensieve_Task(const Pensieve_Task&) = delete;
+
+		Pensieve_Task&
+		operator=(const Pensieve_Task&) = delete;
+
+		//the operation stops at its next span, it's still done through wait and callback with ERROR_CANCELLED
+		API_PNSV void
+		cancel();
+
+		//blocks until the operation is done and returns its error, the waiting thread runs the queued pool tasks meanwhile
+		//so it's safe to wait from a pool task
+		API_PNSV Pensieve::ERROR_CODE
+		wait();
+
+		API_PNSV bool
+		is_done() const;
+
+		API_PNSV void
+		_finish(Pensieve::ERROR_CODE err);
 	};
 }
\ No newline at end of file
@@ -0,0 +1,158 @@
+#pragma once
+
+#include "pensieve/Exports.h"
+#include "pensieve/Pensieve.h"
+
+#include <atomic>
+#include <mutex>
+
+namespace pnsv
+{
+	using namespace cppr;
+
+	//immutable file content which is shared by the snapshots which didn't change it
+	struct Snapshot_Blob
+	{
+		//only touched by the writer
+		usize refs;
+		Owner<byte> data;
+	};
+
+	/**
+	 * Snapshot is an immutable version of an archive
+	 * every file of the archive borrows its content from a blob so it's safe to read from any count of threads
+	 * only the const functions of the archive should be used
+	 */
+	struct Snapshot
+	{
+		std::atomic<usize> refs;
+		u64 version;
+		Pensieve archive;
+		//blob of every header entry of the archive
+		Dynamic_Array<Snapshot_Blob*> blobs;
+
+		//doesn't record the access like Pensieve::file_open since the snapshot is shared
+		API_PNSV Virtual_Handle
+		file_open(const String& path) const;
+	};
+
+	//holds a reference to a snapshot which keeps it alive
+	struct Snapshot_Ref
+	{
+		Snapshot* snapshot;
+
+		Snapshot_Ref()
+			:snapshot(nullptr)
+		{}
+
+		explicit
+		Snapshot_Ref(Snapshot* s)
+			:snapshot(s)
+		{}
+
+		Snapshot_Ref(const Snapshot_Ref&) = delete;
+
+		Snapshot_Ref&
+		operator=(const Snapshot_Ref&) = delete;
+
+		Snapshot_Ref(Snapshot_Ref&& other)
+			:snapshot(other.snapshot)
+		{
+			other.snapshot = nullptr;
+		}
+
+		Snapshot_Ref&
+		operator=(Snapshot_Ref&& other)
+		{
+			release();
+			snapshot = other.snapshot;
+			other.snapshot = nullptr;
+			return *this;
+		}
+
+		~Snapshot_Ref()
+		{
+			release();
+		}
+
+		void
+		release()
+		{
+			if(snapshot)
+				snapshot->refs.fetch_sub(1);
+			snapshot = nullptr;
+		}
+
+		const Snapshot*
+		operator->() const
+		{
+			return snapshot;
+		}
+
+		const Snapshot&
+		operator*() const
+		{
+			return *snapshot;
+		}
+	};
+
+	/**
+	 * A mutable copy of a snapshot, the unchanged files keep borrowing the content of the base snapshot
+	 * and changing a file copies it first
+	 */
+	struct Snapshot_Draft
+	{
+		Snapshot_Ref base;
+		Pensieve archive;
+	};
+
+	/**
+	 * Snapshot_Store publishes the versions of an archive for concurrent readers
+	 * readers acquire the current snapshot without locks and keep it as long as they need
+	 * writers edit a draft of the current snapshot and publish it atomically as the next version
+	 * the replaced snapshots are freed by the writer once no reader holds them
+	 */
+	struct Snapshot_Store
+	{
+		std::atomic<Snapshot*> _current;
+		//count of the readers between loading the current snapshot and referencing it
+		mutable std::atomic<usize> _acquiring;
+		//serializes the writers
+		std::mutex _mutex;
+		Dynamic_Array<Snapshot*> _retired;
+
+		//starts with an empty snapshot of version 0
+		API_PNSV
+		Snapshot_Store();
+
+		Snapshot_Store(const Snapshot_Store&) = delete;
+
+		Snapshot_Store&
+		operator=(const Snapshot_Store&) = delete;
+
+		//all the snapshot refs should be released before the store is destroyed
+		API_PNSV
+		~Snapshot_Store();
+
+		API_PNSV Snapshot_Ref
+		acquire() const;
+
+		API_PNSV Snapshot_Draft
+		draft() const;
+
+		/**
+		 * Publishes the draft as the next version, the draft is consumed
+		 * returns false and leaves the draft as is when another draft was published after it was made
+		 * so the changes should be redone on a new draft
+		 */
+		API_PNSV bool
+		publish(Snapshot_Draft& draft);
+
+		//frees the replaced snapshots which no reader holds anymore, publish calls it too
+		API_PNSV void
+		collect();
+
+		API_PNSV void
+		_collect();
+	};
+}
@@ -0,0 +1,224 @@
+#pragma once
+
+#include "pensieve/Exports.h"
+#include "pensieve/Pensieve.h"
+
+namespace pnsv
+{
+	using namespace cppr;
+
+	enum class COLUMN_TYPE : u8
+	{
+		I32,
+		U32,
+		I64,
+		U64,
+		F32,
+		F64
+	};
+
+	template<typename T>
+	struct Column_Type_Of;
+
+	template<> struct Column_Type_Of<i32> { constexpr static COLUMN_TYPE value = COLUMN_TYPE::I32; };
+	template<> struct Column_Type_Of<u32> { constexpr static COLUMN_TYPE value = COLUMN_TYPE::U32; };
+	template<> struct Column_Type_Of<i64> { constexpr static COLUMN_TYPE value = COLUMN_TYPE::I64; };
+	template<> struct Column_Type_Of<u64> { constexpr static COLUMN_TYPE value = COLUMN_TYPE::U64; };
+	template<> struct Column_Type_Of<r32> { constexpr static COLUMN_TYPE value = COLUMN_TYPE::F32; };
+	template<> struct Column_Type_Of<r64> { constexpr static COLUMN_TYPE value = COLUMN_TYPE::F64; };
+
+	//size of a single value in bytes, 0 for unknown types
+	API_PNSV usize
+	column_type_size(COLUMN_TYPE type);
+
+	struct Table_Column
+	{
+		String name;
+		COLUMN_TYPE type;
+		//offset of the column values from the start of the file content
+		u64 offset;
+	};
+
+	//the values of a column to be written, data points to rows_count values of the type
+	struct Table_Column_Data
+	{
+		String name;
+		COLUMN_TYPE type;
+		const void* data;
+	};
+
+	/**
+	 * A table file stores a fixed schema record set column by column
+	 * the schema comes first so a mounted table reads only the schema and the columns which are used
+	 *
+	 * Table content layout:
+	 * Address Size Description
+	 * +00 4 Magic number
+	 * +04 4 Count of the columns
+	 * +08 8 Count of the rows
+	 * +16 List of the columns
+	 * 	+16 1 type
+	 * 	+17 1 name length
+	 * 	+18 N name
+	 * 	+18+N 8 offset of the column values measured from the start of the content
+	 * the values of every column are contiguous and start at a multiple of COLUMN_ALIGNMENT
+	 *
+	 * the column views point into the file content or the columns read by the table, so they dangle
+	 * once the file is written, cleared or removed, or the table is closed
+	 */
+	struct Table
+	{
+		constexpr static u32 TABLE_MAGIC = 0x4C425450;
+		constexpr static u64 COLUMN_ALIGNMENT = 64;
+		//the scans select the rows with u32 indices
+		constexpr static u64 MAX_ROWS_COUNT = 0xFFFFFFFFULL;
+
+		Pensieve* archive;
+		Virtual_Handle handle;
+		u64 rows_count;
+		Dynamic_Array<Table_Column> columns;
+		//columns which are read from a lazy file, indexed like columns
+		Dynamic_Array<Owner<byte>> _loaded;
+
+		API_PNSV
+		Table();
+
+		Table(const Table&) = delete;
+
+		Table&
+		operator=(const Table&) = delete;
+
+		API_PNSV
+		~Table();
+
+		//reads the schema of the table file, the columns are read when they are first used
+		API_PNSV bool
+		open(Pensieve& archive, Virtual_Handle handle);
+
+		API_PNSV void
+		close();
+
+		//returns usize(-1) if the column doesn't exist
+		API_PNSV usize
+		column_find(const String& name) const;
+
+		//an empty view which isn't valid if the column type isn't T or the column can't be read
+		template<typename T>
+		File_View<T>
+		column(usize index)
+		{
+			if(index >= columns.count() || columns[index].type != Column_Type_Of<T>::value)
+				return File_View<T>{ nullptr, 0, true };
+			return Pensieve::_view_bytes<T>(_column_bytes(index));
+		}
+
+		template<typename T>
+		File_View<T>
+		column(const String& name)
+		{
+			return column<T>(column_find(name));
+		}
+
+		//the bytes of the column, resident files are viewed in place and lazy ones read only this column
+		API_PNSV File_View<byte>
+		_column_bytes(usize index);
+	};
+
+	/**
+	 * Creates a table file with the given columns, every column has rows_count values
+	 * returns an invalid handle if the file exists, a column is invalid or rows_count is above Table::MAX_ROWS_COUNT
+	 */
+	API_PNSV Virtual_Handle
+	table_create(Pensieve& archive, const String& path, const Dynamic_Array<Table_Column_Data>& columns, u64 rows_count);
+
+	API_PNSV bool
+	file_is_table(const Pensieve& archive, Virtual_Handle handle);
+
+	enum class SCAN_OP : u8
+	{
+		LESS,
+		LESS_EQUAL,
+		EQUAL,
+		NOT_EQUAL,
+		GREATER_EQUAL,
+		GREATER
+	};
+
+	/**
+	 * Scan kernels over the numeric columns
+	 * column_filter appends the indices of the rows which pass `value[row] op value` to rows
+	 * column_refine keeps only the rows which pass, so filters on multiple columns can be chained
+	 * column_sum sums the selected rows or the whole column, the integers are summed in 64-bit and the floats in r64
+	 */
+	API_PNSV void
+	column_filter(File_View<i32> column, SCAN_OP op, i32 value, Dynamic_Array<u32>& rows);
+
+	API_PNSV void
+	column_filter(File_View<u32> column, SCAN_OP op, u32 value, Dynamic_Array<u32>& rows);
+
+	API_PNSV void
+	column_filter(File_View<i64> column, SCAN_OP op, i64 value, Dynamic_Array<u32>& rows);
+
+	API_PNSV void
+	column_filter(File_View<u64> column, SCAN_OP op, u64 value, Dynamic_Array<u32>& rows);
+
+	API_PNSV void
+	column_filter(File_View<r32> column, SCAN_OP op, r32 value, Dynamic_Array<u32>& rows);
+
+	API_PNSV void
+	column_filter(File_View<r64> column, SCAN_OP op, r64 value, Dynamic_Array<u32>& rows);
+
+	API_PNSV void
+	column_refine(File_View<i32> column, SCAN_OP op, i32 value, Dynamic_Array<u32>& rows);
+
+	API_PNSV void
+	column_refine(File_View<u32> column, SCAN_OP op, u32 value, Dynamic_Array<u32>& rows);
+
+	API_PNSV void
+	column_refine(File_View<i64> column, SCAN_OP op, i64 value, Dynamic_Array<u32>& rows);
+
+	API_PNSV void
+	column_refine(File_View<u64> column, SCAN_OP op, u64 value, Dynamic_Array<u32>& rows);
+
+	API_PNSV void
+	column_refine(File_View<r32> column, SCAN_OP op, r32 value, Dynamic_Array<u32>& rows);
+
+	API_PNSV void
+	column_refine(File_View<r64> column, SCAN_OP op, r64 value, Dynamic_Array<u32>& rows);
+
+	API_PNSV i64
+	column_sum(File_View<i32> column);
+
+	API_PNSV u64
+	column_sum(File_View<u32> column);
+
+	API_PNSV i64
+	column_sum(File_View<i64> column);
+
+	API_PNSV u64
+	column_sum(File_View<u64> column);
+
+	API_PNSV r64
+	column_sum(File_View<r32> column);
+
+	API_PNSV r64
+	column_sum(File_View<r64> column);
+
+	API_PNSV i64
+	column_sum(File_View<i32> column, const Dynamic_Array<u32>& rows);
+
+	API_PNSV u64
+	column_sum(File_View<u32> column, const Dynamic_Array<u32>& rows);
+
+	API_PNSV i64
+	column_sum(File_View<i64> column, const Dynamic_Array<u32>& rows);
+
+	API_PNSV u64
+	column_sum(File_View<u64> column, const Dynamic_Array<u32>& rows);
+
+	API_PNSV r64
+	column_sum(File_View<r32> column, const Dynamic_Array<u32>& rows);
+
+	API_PNSV r64
+	column_sum(File_View<r64> column, const Dynamic_Array<u32>& rows);
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include "pensieve/Exports.h"
+
+#include <cpprelude/Dynamic_Array.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+namespace pnsv
+{
+	using namespace cppr;
+
+	using Task_Function = void(*)(void* user_data);
+
+	//counts the unfinished tasks which were submitted with it
+	struct Task_Group
+	{
+		std::atomic<usize> pending;
+
+		Task_Group()
+			:pending(0)
+		{}
+	};
+
+	struct Task
+	{
+		Task_Function function;
+		void* user_data;
+		Task_Group* group;
+	};
+
+	struct Thread_Pool_Config
+	{
+		//0 means one worker per hardware thread
+		usize workers_count;
+		//cpu of each worker, workers beyond the list and all of them when it's empty aren't pinned
+		Dynamic_Array<i32> affinity;
+	};
+
+	struct Task_Worker;
+
+	/**
+	 * Thread_Pool runs tasks on a fixed set of workers, each with its own queue
+	 * a worker runs its newest task first and steals the oldest tasks of the others when its queue is empty
+	 * the tasks submitted from a worker go to its own queue so the split work of an operation stays on the same worker
+	 * the library never starts threads on its own, the pool is created by the app and set with thread_pool_set
+	 */
+	struct Thread_Pool
+	{
+		Dynamic_Array<Task_Worker*> _workers;
+		Dynamic_Array<std::thread> _threads;
+		std::mutex _mutex;
+		std::condition_variable _wake;
+		std::atomic<usize> _queued;
+		std::atomic<usize> _next;
+		bool _stop;
+
+		API_PNSV explicit
+		Thread_Pool(const Thread_Pool_Config& config);
+
+		Thread_Pool(const Thread_Pool&) = delete;
+
+		Thread_Pool&
+		operator=(const Thread_Pool&) = delete;
+
+		//the queued tasks are finished before the workers exit
+		API_PNSV
+		~Thread_Pool();
+
+		API_PNSV usize
+		workers_count() const;
+
+		API_PNSV void
+		submit(Task_Group& group, Task_Function function, void* user_data);
+
+		//runs the queued tasks on the calling thread until the group is done, so it's safe to wait from a task
+		API_PNSV void
+		wait(Task_Group& group);
+
+		//blocks until a task is queued or the flag is set, whoever sets the flag calls wake afterwards
+		API_PNSV void
+		wait_for_work(const std::atomic<bool>& flag);
+
+		//wakes the threads which wait on the pool so they check their conditions again
+		API_PNSV void
+		wake();
+
+		//pops a task from the given worker queue or steals one from the others, usize(-1) is no worker
+		API_PNSV bool
+		_task_take(usize worker, Task& task);
+
+		API_PNSV void
+		_task_run(const Task& task);
+	};
+
+	//sets the pool which the async operations and the parallel reads run on, nullptr runs them on the calling thread
+	API_PNSV void
+	thread_pool_set(Thread_Pool* pool);
+
+	API_PNSV Thread_Pool*
+	thread_pool();
+}
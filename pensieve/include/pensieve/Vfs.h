@@ -0,0 +1,112 @@
+#pragma once
+
+#include "pensieve/Exports.h"
+#include "pensieve/Pensieve.h"
+
+namespace pnsv
+{
+	using namespace cppr;
+
+	struct Vfs_Handle
+	{
+		usize shard;
+		Virtual_Handle handle;
+
+		bool
+		valid() const
+		{
+			return shard != usize(-1) && handle.valid();
+		}
+	};
+	constexpr static Vfs_Handle INVALID_VFS_HANDLE { usize(-1), INVALID_FILE_HANDLE };
+
+	struct Vfs_Shard
+	{
+		String path;
+		Pensieve archive;
+		//last access tick, used to pick the shard which loses its file when too many are open
+		usize last_use;
+	};
+
+	/**
+	 * Vfs mounts many archives (shards) as one file system
+	 * the headers of all the shards are merged into one hash index so a lookup costs the same for any count of shards
+	 * the content is fetched lazily and at most max_open_files shards keep their file open at the same time
+	 * when the same path exists in multiple shards the last mounted one wins, and its whiteouts hide the path
+	 */
+	struct Vfs
+	{
+		struct Index_Slot
+		{
+			u64 hash;
+			Vfs_Handle handle;
+		};
+
+		Dynamic_Array<Vfs_Shard> shards;
+		usize max_open_files;
+		usize open_files;
+		//optional cache which is shared by the shards mounted after it's set
+		Block_Cache* cache;
+
+		//open addressing table with a power of two capacity
+		Dynamic_Array<Index_Slot> _index;
+		usize _index_count;
+		usize _tick;
+
+		API_PNSV explicit
+		Vfs(usize max_open_files = 64);
+
+		API_PNSV Pensieve::ERROR_CODE
+		mount(const char* path);
+
+		API_PNSV Vfs_Handle
+		file_open(const String& path) const;
+
+		API_PNSV bool
+		file_exists(const String& path) const;
+
+		API_PNSV const String&
+		file_name(Vfs_Handle handle) const;
+
+		API_PNSV u64
+		file_size(Vfs_Handle handle) const;
+
+		API_PNSV File_Stat
+		file_stat(Vfs_Handle handle) const;
+
+		//asserts that the shard file could be opened, use files_read_batch first to handle the io errors
+		API_PNSV Memory_Stream&
+		file_stream(Vfs_Handle handle);
+
+		API_PNSV usize
+		file_read(Vfs_Handle handle, u64 offset, Slice<byte> data);
+
+		API_PNSV Dynamic_Array<Vfs_Handle>
+		files_match(const String& pattern) const;
+
+		//fetches the given files with one batch per shard
+		API_PNSV bool
+		files_read_batch(const Dynamic_Array<Vfs_Handle>& handles);
+
+		//finds the visible entry of the path without recording it in the trace
+		API_PNSV Vfs_Handle
+		_file_lookup(const String& path) const;
+
+		API_PNSV Vfs_Handle
+		_index_find(const String& path, u64 hash) const;
+
+		API_PNSV void
+		_index_insert(Vfs_Handle handle, u64 hash);
+
+		API_PNSV void
+		_index_grow();
+
+		//opens the shard file, closing the least recently used one if needed
+		API_PNSV bool
+		_shard_acquire(usize shard);
+
+		//closes the file of the least recently used shard
+		API_PNSV void
+		_shard_evict();
+	};
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include "pensieve/Exports.h"
+#include "pensieve/Disk.h"
+
+#include <cpprelude/IO_Trait.h>
+#include <cpprelude/Dynamic_Array.h>
+#include <cpprelude/String.h>
+
+namespace pnsv
+{
+	using namespace cppr;
+
+	/**
+	 * Volume_Set splits one logical archive file into stripes which are spread round robin over multiple volume files
+	 * the archive header and chunks keep their usual layout in the logical file, so the volumes share one header
+	 * a range which covers multiple stripes is read and written in parallel per volume on the shared thread pool,
+	 * or one volume after the other on the calling thread when no pool is set
+	 *
+	 * Volume file layout:
+	 * Address Size Description
+	 * +00 4 Magic number
+	 * +04 2 Index of this volume
+	 * +06 2 Count of the volumes in the set
+	 * +08 8 Stripe size
+	 * +16 8 Id of the set, all the volumes of one set have the same id
+	 * +24 8 Size of the logical file
+	 * +32 The stripes of this volume, stripe S of the logical file is the stripe (S / count) of volume (S % count)
+	 */
+	struct Volume_Set
+	{
+		constexpr static u32 VOLUME_MAGIC = 0x33D9AFEF;
+		constexpr static u64 VOLUME_HEADER_SIZE = 32;
+		constexpr static u64 DEFAULT_STRIPE_SIZE = 1ULL * 1024ULL * 1024ULL;
+
+		Dynamic_Array<Disk_File> files;
+		u64 stripe_size;
+		u64 set_id;
+		//size of the logical file
+		u64 size;
+		//the volumes are opened for writing and their headers are written on close
+		bool writable;
+
+		API_PNSV
+		Volume_Set();
+
+		Volume_Set(const Volume_Set&) = delete;
+
+		Volume_Set&
+		operator=(const Volume_Set&) = delete;
+
+		API_PNSV
+		~Volume_Set();
+
+		//creates or truncates the volume files, the stripe size is rounded up to 4KiB
+		API_PNSV bool
+		create(const Dynamic_Array<String>& paths, u64 stripe_size = DEFAULT_STRIPE_SIZE);
+
+		//opens the volume files which should be given in the same order they were created with
+		API_PNSV bool
+		open(const Dynamic_Array<String>& paths);
+
+		//closes the volume files, the writable ones get their headers first
+		API_PNSV bool
+		close();
+
+		bool
+		valid() const
+		{
+			return files.empty() == false;
+		}
+
+		//returns the count of bytes read which is less than data.size only at the end of the logical file or on errors
+		API_PNSV usize
+		read(u64 offset, Slice<byte> data) const;
+
+		//returns the count of bytes written which is less than data.size only on errors
+		API_PNSV usize
+		write(u64 offset, Slice<byte> data);
+	};
+
+	/**
+	 * Volume_Writer is an IO_Trait which writes a stream sequentially to the logical file of a writable set
+	 * the writes are gathered until they cover a stripe on every volume so each write to the set keeps all of them busy
+	 */
+	struct Volume_Writer
+	{
+		IO_Trait _io_trait;
+		Volume_Set* set;
+		Owner<byte> _buffer;
+		usize _buffered;
+		//logical offset of the next write to the set
+		u64 offset;
+		bool failed;
+
+		API_PNSV explicit
+		Volume_Writer(Volume_Set& volume_set, u64 start_offset = 0);
+
+		Volume_Writer(const Volume_Writer&) = delete;
+
+		Volume_Writer&
+		operator=(const Volume_Writer&) = delete;
+
+		//the gathered bytes which weren't flushed are dropped
+		API_PNSV
+		~Volume_Writer();
+
+		//returns 0 once a write to the set failed
+		API_PNSV usize
+		write(const Slice<byte>& data);
+
+		//writes the gathered bytes, returns false when any write to the set failed
+		API_PNSV bool
+		flush();
+
+		operator IO_Trait*()
+		{
+			return &_io_trait;
+		}
+	};
+}
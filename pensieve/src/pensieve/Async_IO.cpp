@@ -0,0 +1,527 @@
+#include "pensieve/Async_IO.h"
+
+#if defined(OS_LINUX) && defined(__has_include)
+	#if __has_include(<linux/io_uring.h>)
+		#include <linux/io_uring.h>
+	#endif
+#endif
+
+//IO_URING_OP_SUPPORTED comes with the probe interface which we need to detect read/write support
+#if defined(OS_LINUX) && defined(IO_URING_OP_SUPPORTED)
+	#define PNSV_IO_URING 1
+	#include <sys/mman.h>
+	#include <sys/syscall.h>
+	#include <unistd.h>
+	#include <errno.h>
+	#include <string.h>
+#endif
+
+#include <new>
+#include <utility>
+
+namespace pnsv
+{
+	//io_uring transfers are limited to u32 lengths so the big ones are split
+	constexpr static usize MAX_RING_TRANSFER = usize(1) << 30;
+
+	#if defined(PNSV_IO_URING)
+	//user_data of the cancel sqes, their completions don't belong to any request
+	constexpr static u64 CANCEL_USER_DATA = u64(-1);
+	#endif
+
+	#if defined(PNSV_IO_URING)
+
+	struct Ring
+	{
+		int fd;
+
+		u32* sq_head;
+		u32* sq_tail;
+		u32* sq_mask;
+		u32* sq_array;
+		io_uring_sqe* sqes;
+
+		u32* cq_head;
+		u32* cq_tail;
+		u32* cq_mask;
+		io_uring_cqe* cqes;
+
+		void* sq_ptr;
+		usize sq_size;
+		void* cq_ptr;
+		usize cq_size;
+		usize sqes_size;
+
+		//sqes which are queued in the ring but not passed to the kernel yet
+		u32 to_submit;
+
+		//requests in flight by their slot which is the sqe user_data, so a broken ring can fail them
+		Owner<Async_Request*> slots;
+		Owner<u32> free_slots;
+		u32 free_count;
+
+		//a broken ring isn't fed anymore, it stays mapped until the kernel is done with its requests
+		bool broken;
+	};
+
+	static void
+	_ring_free(Ring* ring)
+	{
+		if(ring->sqes)
+			munmap(ring->sqes, ring->sqes_size);
+		if(ring->cq_ptr && ring->cq_ptr != ring->sq_ptr)
+			munmap(ring->cq_ptr, ring->cq_size);
+		if(ring->sq_ptr)
+			munmap(ring->sq_ptr, ring->sq_size);
+		if(ring->fd >= 0)
+			close(ring->fd);
+		if(ring->slots.ptr)
+			free(ring->slots);
+		if(ring->free_slots.ptr)
+			free(ring->free_slots);
+		ring->~Ring();
+		free(Owner<Ring>(ring, 1));
+	}
+
+	static bool
+	_ring_supports_read_write(int fd)
+	{
+		constexpr usize OPS_COUNT = 256;
+		usize probe_size = sizeof(io_uring_probe) + OPS_COUNT * sizeof(io_uring_probe_op);
+		auto probe_data = alloc<byte>(probe_size);
+		::memset(probe_data.ptr, 0, probe_size);
+		io_uring_probe* probe = reinterpret_cast<io_uring_probe*>(probe_data.ptr);
+
+		bool result = false;
+		if(syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, OPS_COUNT) == 0)
+		{
+			result = probe->last_op >= IORING_OP_WRITE &&
+					 (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED) &&
+					 (probe->ops[IORING_OP_WRITE].flags & IO_URING_OP_SUPPORTED);
+		}
+
+		free(probe_data);
+		return result;
+	}
+
+	static Ring*
+	_ring_new(u32 entries)
+	{
+		io_uring_params params{};
+		int fd = int(syscall(__NR_io_uring_setup, entries, &params));
+		if(fd < 0)
+			return nullptr;
+
+		Ring* ring = ::new(alloc<Ring>().ptr) Ring{};
+		ring->fd = fd;
+
+		ring->slots = alloc<Async_Request*>(entries);
+		ring->free_slots = alloc<u32>(entries);
+		for(u32 i = 0; i < entries; ++i)
+		{
+			ring->slots[i] = nullptr;
+			ring->free_slots[i] = entries - 1 - i;
+		}
+		ring->free_count = entries;
+
+		if(_ring_supports_read_write(fd) == false)
+		{
+			_ring_free(ring);
+			return nullptr;
+		}
+
+		ring->sq_size = params.sq_off.array + params.sq_entries * sizeof(u32);
+		ring->cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+		bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+		if(single_mmap)
+		{
+			if(ring->cq_size > ring->sq_size)
+				ring->sq_size = ring->cq_size;
+			ring->cq_size = ring->sq_size;
+		}
+
+		void* sq_ptr = mmap(nullptr, ring->sq_size, PROT_READ | PROT_WRITE,
+							MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+		if(sq_ptr == MAP_FAILED)
+		{
+			_ring_free(ring);
+			return nullptr;
+		}
+		ring->sq_ptr = sq_ptr;
+
+		if(single_mmap)
+		{
+			ring->cq_ptr = sq_ptr;
+		}
+		else
+		{
+			void* cq_ptr = mmap(nullptr, ring->cq_size, PROT_READ | PROT_WRITE,
+								MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+			if(cq_ptr == MAP_FAILED)
+			{
+				_ring_free(ring);
+				return nullptr;
+			}
+			ring->cq_ptr = cq_ptr;
+		}
+
+		ring->sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+		void* sqes = mmap(nullptr, ring->sqes_size, PROT_READ | PROT_WRITE,
+						  MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+		if(sqes == MAP_FAILED)
+		{
+			_ring_free(ring);
+			return nullptr;
+		}
+		ring->sqes = static_cast<io_uring_sqe*>(sqes);
+
+		byte* sq = static_cast<byte*>(ring->sq_ptr);
+		ring->sq_head = reinterpret_cast<u32*>(sq + params.sq_off.head);
+		ring->sq_tail = reinterpret_cast<u32*>(sq + params.sq_off.tail);
+		ring->sq_mask = reinterpret_cast<u32*>(sq + params.sq_off.ring_mask);
+		ring->sq_array = reinterpret_cast<u32*>(sq + params.sq_off.array);
+
+		byte* cq = static_cast<byte*>(ring->cq_ptr);
+		ring->cq_head = reinterpret_cast<u32*>(cq + params.cq_off.head);
+		ring->cq_tail = reinterpret_cast<u32*>(cq + params.cq_off.tail);
+		ring->cq_mask = reinterpret_cast<u32*>(cq + params.cq_off.ring_mask);
+		ring->cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+		return ring;
+	}
+
+	static void
+	_ring_push(Ring* ring, u32 slot)
+	{
+		Async_Request* request = ring->slots[slot];
+		u32 tail = *ring->sq_tail;
+		u32 index = tail & *ring->sq_mask;
+
+		usize remaining = request->data.size - request->result;
+		if(remaining > MAX_RING_TRANSFER)
+			remaining = MAX_RING_TRANSFER;
+
+		io_uring_sqe* sqe = &ring->sqes[index];
+		::memset(sqe, 0, sizeof(*sqe));
+		sqe->opcode = request->write ? IORING_OP_WRITE : IORING_OP_READ;
+		sqe->fd = int(request->file.handle);
+		sqe->off = request->offset + request->result;
+		sqe->addr = u64(request->data.ptr + request->result);
+		sqe->len = u32(remaining);
+		sqe->user_data = u64(slot);
+
+		ring->sq_array[index] = index;
+		__atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+		++ring->to_submit;
+	}
+
+	static bool
+	_ring_enter(Ring* ring, u32 min_complete)
+	{
+		u32 flags = min_complete > 0 ? IORING_ENTER_GETEVENTS : 0;
+		while(true)
+		{
+			int result = int(syscall(__NR_io_uring_enter, ring->fd, ring->to_submit, min_complete, flags, nullptr, 0));
+			if(result < 0 && errno == EINTR)
+				continue;
+			//the completion queue is full or the kernel is out of memory, it's retried after the completions are reaped
+			if(result < 0 && (errno == EAGAIN || errno == EBUSY))
+				return true;
+			if(result < 0)
+				return false;
+
+			ring->to_submit -= u32(result);
+			return true;
+		}
+	}
+
+	static void
+	_ring_submit(Ring* ring, Async_Request* request)
+	{
+		u32 slot = ring->free_slots[--ring->free_count];
+		ring->slots[slot] = request;
+		_ring_push(ring, slot);
+	}
+
+	static void
+	_ring_release(Async_IO& self, u32 slot)
+	{
+		Ring* ring = static_cast<Ring*>(self._ring);
+		self._ready.insert_back(ring->slots[slot]);
+		ring->slots[slot] = nullptr;
+		ring->free_slots[ring->free_count++] = slot;
+		--self.in_flight;
+	}
+
+	//takes back the sqes the kernel didn't consume, their requests never started so they fail with their partial result
+	static void
+	_ring_retract(Async_IO& self)
+	{
+		Ring* ring = static_cast<Ring*>(self._ring);
+		u32 head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+		u32 tail = *ring->sq_tail;
+		for(u32 i = head; i != tail; ++i)
+		{
+			u64 user_data = ring->sqes[ring->sq_array[i & *ring->sq_mask]].user_data;
+			if(user_data != CANCEL_USER_DATA)
+				_ring_release(self, u32(user_data));
+		}
+		__atomic_store_n(ring->sq_tail, head, __ATOMIC_RELEASE);
+		ring->to_submit = 0;
+	}
+
+	//the broken ring is freed once nothing of ours is left in the kernel
+	static void
+	_ring_drained(Async_IO& self)
+	{
+		Ring* ring = static_cast<Ring*>(self._ring);
+		if(ring->broken && self.in_flight == 0)
+		{
+			_ring_free(ring);
+			self._ring = nullptr;
+		}
+	}
+
+	//the ring can't be entered anymore so the queue falls back to blocking, the pending requests run there
+	//the kernel could still be writing into the buffers of the requests in flight so they're cancelled
+	//and the ring stays mapped until their completions are reaped, then they fail with their partial result
+	static void
+	_ring_break(Async_IO& self)
+	{
+		Ring* ring = static_cast<Ring*>(self._ring);
+		ring->broken = true;
+		self.backend = ASYNC_BACKEND_BLOCKING;
+		_ring_retract(self);
+
+		u32 entries = u32(ring->slots.size);
+		for(u32 slot = 0; slot < entries; ++slot)
+		{
+			if(ring->slots[slot] == nullptr)
+				continue;
+
+			u32 tail = *ring->sq_tail;
+			u32 index = tail & *ring->sq_mask;
+			io_uring_sqe* sqe = &ring->sqes[index];
+			::memset(sqe, 0, sizeof(*sqe));
+			sqe->opcode = IORING_OP_ASYNC_CANCEL;
+			sqe->fd = -1;
+			sqe->addr = u64(slot);
+			sqe->user_data = CANCEL_USER_DATA;
+
+			ring->sq_array[index] = index;
+			__atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+			++ring->to_submit;
+		}
+		//if the cancels can't be submitted either we just wait for the requests to finish
+		if(ring->to_submit > 0 && _ring_enter(ring, 0) == false)
+			_ring_retract(self);
+
+		_ring_drained(self);
+	}
+
+	static usize
+	_ring_poll(Async_IO& self)
+	{
+		Ring* ring = static_cast<Ring*>(self._ring);
+		if(ring->to_submit > 0 && _ring_enter(ring, 0) == false)
+		{
+			if(ring->broken)
+			{
+				_ring_retract(self);
+			}
+			else
+			{
+				_ring_break(self);
+				return 0;
+			}
+		}
+
+		usize completed = 0;
+		u32 head = *ring->cq_head;
+		while(head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+		{
+			io_uring_cqe* cqe = &ring->cqes[head & *ring->cq_mask];
+			u64 user_data = cqe->user_data;
+			i32 res = cqe->res;
+
+			++head;
+			__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+			if(user_data == CANCEL_USER_DATA)
+				continue;
+
+			u32 slot = u32(user_data);
+			Async_Request* request = ring->slots[slot];
+
+			//short transfers and interrupted requests are pushed again for the rest of the data
+			if(ring->broken == false &&
+			   (res == -EINTR || res == -EAGAIN ||
+				(res > 0 && request->result + usize(res) < request->data.size)))
+			{
+				if(res > 0)
+					request->result += usize(res);
+				_ring_push(ring, slot);
+				continue;
+			}
+
+			ring->slots[slot] = nullptr;
+			ring->free_slots[ring->free_count++] = slot;
+			--self.in_flight;
+
+			if(res > 0)
+				request->result += usize(res);
+			request->callback(request);
+			++completed;
+		}
+
+		if(ring->broken)
+		{
+			_ring_drained(self);
+			return completed;
+		}
+
+		//move the overflow into the freed ring slots
+		usize i = 0;
+		for(; i < self._pending.count() && self.in_flight < self.queue_depth; ++i)
+		{
+			_ring_submit(ring, self._pending[i]);
+			++self.in_flight;
+		}
+		if(i > 0)
+		{
+			Dynamic_Array<Async_Request*> rest;
+			for(usize j = i; j < self._pending.count(); ++j)
+				rest.insert_back(self._pending[j]);
+			self._pending = std::move(rest);
+		}
+
+		if(ring->to_submit > 0 && _ring_enter(ring, 0) == false)
+			_ring_break(self);
+		return completed;
+	}
+
+	#endif
+
+	Async_IO::Async_IO(usize depth, ASYNC_BACKEND preferred)
+		:backend(ASYNC_BACKEND_BLOCKING),
+		 queue_depth(depth == 0 ? 1 : depth),
+		 in_flight(0),
+		 _ring(nullptr)
+	{
+		#if defined(PNSV_IO_URING)
+		if(preferred == ASYNC_BACKEND_IO_URING)
+		{
+			_ring = _ring_new(u32(queue_depth));
+			if(_ring)
+				backend = ASYNC_BACKEND_IO_URING;
+		}
+		#else
+		(void)preferred;
+		#endif
+	}
+
+	Async_IO::~Async_IO()
+	{
+		wait_all();
+
+		#if defined(PNSV_IO_URING)
+		if(_ring)
+			_ring_free(static_cast<Ring*>(_ring));
+		#endif
+	}
+
+	void
+	Async_IO::submit(Async_Request* request)
+	{
+		request->result = 0;
+
+		if(request->data.size == 0)
+		{
+			_ready.insert_back(request);
+			return;
+		}
+
+		#if defined(PNSV_IO_URING)
+		if(backend == ASYNC_BACKEND_IO_URING && in_flight < queue_depth)
+		{
+			_ring_submit(static_cast<Ring*>(_ring), request);
+			++in_flight;
+			return;
+		}
+		#endif
+
+		//the blocking backend and the overflow of a full ring wait in the pending queue
+		_pending.insert_back(request);
+	}
+
+	usize
+	Async_IO::poll()
+	{
+		usize completed = 0;
+
+		#if defined(PNSV_IO_URING)
+		//a broken ring is still polled until its requests are reaped
+		if(_ring)
+			completed += _ring_poll(*this);
+		#endif
+
+		//callbacks could submit more requests so we work on detached batches
+		Dynamic_Array<Async_Request*> ready(std::move(_ready));
+		_ready = Dynamic_Array<Async_Request*>();
+		for(auto request: ready)
+		{
+			request->callback(request);
+			++completed;
+		}
+
+		if(backend != ASYNC_BACKEND_BLOCKING)
+			return completed;
+
+		Dynamic_Array<Async_Request*> batch(std::move(_pending));
+		_pending = Dynamic_Array<Async_Request*>();
+
+		for(auto request: batch)
+		{
+			if(request->write)
+				request->result = disk_write_at(request->file, request->offset, request->data);
+			else
+				request->result = disk_read_at(request->file, request->offset, request->data);
+			request->callback(request);
+			++completed;
+		}
+		return completed;
+	}
+
+	usize
+	Async_IO::wait()
+	{
+		#if defined(PNSV_IO_URING)
+		//a broken ring switches the backend so the loop ends once its requests are reaped
+		while(_ring && (in_flight > 0 || (backend == ASYNC_BACKEND_IO_URING && _pending.empty() == false)))
+		{
+			Ring* ring = static_cast<Ring*>(_ring);
+			if(_ready.empty() && in_flight > 0 && _ring_enter(ring, 1) == false)
+			{
+				if(ring->broken)
+					_ring_retract(*this);
+				else
+					_ring_break(*this);
+			}
+
+			usize completed = poll();
+			if(completed > 0)
+				return completed;
+		}
+		#endif
+
+		return poll();
+	}
+
+	void
+	Async_IO::wait_all()
+	{
+		while(in_flight > 0 || _pending.empty() == false || _ready.empty() == false)
+			if(wait() == 0)
+				break;
+	}
+}
@@ -0,0 +1,224 @@
+#include "pensieve/Block_Cache.h"
+
+#include <string.h>
+
+namespace pnsv
+{
+	static usize
+	_block_hash(u64 archive, u64 block)
+	{
+		//splitmix64 finalizer over the combined key
+		u64 x = archive * 0x9E3779B97F4A7C15ULL ^ block;
+		x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+		return usize(x ^ (x >> 31));
+	}
+
+	u64
+	archive_id_new()
+	{
+		static std::atomic<u64> next_id(1);
+		return next_id.fetch_add(1);
+	}
+
+	Block_Cache::Block_Cache(usize memory_budget, usize block)
+		:block_size(block == 0 ? DEFAULT_BLOCK_SIZE : block),
+		 _hand(0),
+		 _hits(0),
+		 _misses(0),
+		 _evictions(0)
+	{
+		usize slots_count = memory_budget / block_size;
+		if(slots_count == 0)
+			slots_count = 1;
+
+		_memory = alloc<byte>(slots_count * block_size);
+		_slots.reserve(slots_count);
+		_buckets.reserve(slots_count);
+		for(usize i = 0; i < slots_count; ++i)
+		{
+			_slots.insert_back(Slot { 0, 0, 0, usize(-1), false, false, false });
+			_buckets.insert_back(usize(-1));
+		}
+	}
+
+	Block_Cache::~Block_Cache()
+	{
+		free(_memory);
+	}
+
+	usize
+	Block_Cache::read(u64 archive, Disk_File file, u64 offset, Slice<byte> data)
+	{
+		usize done = 0;
+		while(done < data.size)
+		{
+			u64 position = offset + done;
+			u64 block = position / block_size;
+			usize block_offset = usize(position % block_size);
+			usize wanted = data.size - done;
+			if(wanted > block_size - block_offset)
+				wanted = block_size - block_offset;
+
+			usize available = 0;
+			bool hit = false;
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+				usize slot = _find(archive, block);
+				if(slot != usize(-1))
+				{
+					hit = true;
+					auto& s = _slots[slot];
+					s.referenced = true;
+					available = s.size > block_offset ? s.size - block_offset : 0;
+					if(available > wanted)
+						available = wanted;
+					::memcpy(data.ptr + done, _memory.ptr + slot * block_size + block_offset, available);
+				}
+			}
+
+			if(hit)
+			{
+				++_hits;
+			}
+			else
+			{
+				++_misses;
+
+				//the block is read straight into a victim slot which is out of the clock until it's filled
+				//the disk read happens outside the lock so the hits aren't blocked by it
+				usize slot = usize(-1);
+				{
+					std::lock_guard<std::mutex> lock(_mutex);
+					slot = _victim();
+					if(slot != usize(-1))
+					{
+						auto& s = _slots[slot];
+						if(s.used)
+						{
+							_unlink(slot);
+							++_evictions;
+						}
+						s.used = false;
+						s.loading = true;
+					}
+				}
+
+				if(slot == usize(-1))
+				{
+					//every slot is being filled by other threads so the range is read without caching it
+					available = disk_read_at(file, position, make_slice(data.ptr + done, wanted));
+				}
+				else
+				{
+					byte* memory = _memory.ptr + slot * block_size;
+					usize size = disk_read_at(file, block * block_size, make_slice(memory, block_size));
+					available = size > block_offset ? size - block_offset : 0;
+					if(available > wanted)
+						available = wanted;
+					::memcpy(data.ptr + done, memory + block_offset, available);
+
+					std::lock_guard<std::mutex> lock(_mutex);
+					auto& s = _slots[slot];
+					s.loading = false;
+					//another thread could have loaded the same block meanwhile
+					if(size > 0 && _find(archive, block) == usize(-1))
+					{
+						usize bucket = _block_hash(archive, block) % _buckets.count();
+						s.archive = archive;
+						s.block = block;
+						s.size = size;
+						s.used = true;
+						s.referenced = false;
+						s.next = _buckets[bucket];
+						_buckets[bucket] = slot;
+					}
+				}
+			}
+
+			done += available;
+			if(available < wanted)
+				break;
+		}
+		return done;
+	}
+
+	Block_Cache_Stats
+	Block_Cache::stats() const
+	{
+		Block_Cache_Stats result{};
+		result.hits = _hits.load();
+		result.misses = _misses.load();
+		result.evictions = _evictions.load();
+
+		std::lock_guard<std::mutex> lock(_mutex);
+		for(const auto& slot: _slots)
+			if(slot.used)
+				++result.blocks_count;
+		return result;
+	}
+
+	void
+	Block_Cache::evict(u64 archive)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		for(usize i = 0; i < _slots.count(); ++i)
+		{
+			if(_slots[i].used && _slots[i].archive == archive)
+			{
+				_unlink(i);
+				_slots[i].used = false;
+				_slots[i].referenced = false;
+			}
+		}
+	}
+
+	usize
+	Block_Cache::_victim()
+	{
+		//CLOCK: referenced slots get a second chance and the first unreferenced one is taken
+		//two rounds clear every reference bit so only the slots which are being filled could be left
+		usize count = _slots.count();
+		for(usize i = 0; i < count * 2; ++i)
+		{
+			usize slot = _hand;
+			auto& s = _slots[slot];
+			_hand = (_hand + 1) % count;
+
+			if(s.loading)
+				continue;
+			if(s.used && s.referenced)
+			{
+				s.referenced = false;
+				continue;
+			}
+			return slot;
+		}
+		return usize(-1);
+	}
+
+	usize
+	Block_Cache::_find(u64 archive, u64 block) const
+	{
+		usize slot = _buckets[_block_hash(archive, block) % _buckets.count()];
+		while(slot != usize(-1))
+		{
+			const auto& s = _slots[slot];
+			if(s.archive == archive && s.block == block)
+				return slot;
+			slot = s.next;
+		}
+		return usize(-1);
+	}
+
+	void
+	Block_Cache::_unlink(usize slot)
+	{
+		auto& s = _slots[slot];
+		usize* link = &_buckets[_block_hash(s.archive, s.block) % _buckets.count()];
+		while(*link != slot)
+			link = &_slots[*link].next;
+		*link = s.next;
+		s.next = usize(-1);
+	}
+}
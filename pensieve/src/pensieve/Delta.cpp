@@ -0,0 +1,848 @@
+#include "pensieve/Delta.h"
+
+#include <cpprelude/File.h>
+
+#include <algorithm>
+#include <string.h>
+
+namespace pnsv
+{
+	//buffers the patch writes and keeps the crc of everything written after the magic
+	struct Patch_Writer
+	{
+		IO_Trait* io;
+		Memory_Stream buffer;
+		u32 crc;
+		bool ok;
+
+		void
+		put(const void* ptr, usize size)
+		{
+			crc = crc32_slurp(crc, ptr, size);
+			vprintb(buffer, make_slice(static_cast<const byte*>(ptr), size));
+			if(buffer.size() >= STREAM_BUFFER_SIZE)
+				flush();
+		}
+
+		template<typename T>
+		void
+		put(const T& value)
+		{
+			put(&value, sizeof(value));
+		}
+
+		void
+		put_string(const String& str)
+		{
+			u16 size = u16(str.size());
+			put(size);
+			put(str.data(), size);
+		}
+
+		void
+		flush()
+		{
+			auto data = buffer.bin_content();
+			if(data.size > 0 && vprintb(io, data) != data.size)
+				ok = false;
+			buffer.clear();
+		}
+	};
+
+	//reads the patch through a buffer and keeps the crc of everything read after the magic
+	struct Patch_Reader
+	{
+		IO_Trait* io;
+		Owner<byte> buffer;
+		usize position;
+		usize end;
+		u32 crc;
+		bool ok;
+
+		bool
+		get_raw(void* ptr, usize size)
+		{
+			byte* out = static_cast<byte*>(ptr);
+			while(size > 0 && ok)
+			{
+				if(position == end)
+				{
+					position = 0;
+					end = vreadb(io, make_slice(buffer.ptr, buffer.size));
+					if(end == 0)
+					{
+						ok = false;
+						break;
+					}
+				}
+
+				usize available = end - position < size ? end - position : size;
+				::memcpy(out, buffer.ptr + position, available);
+				position += available;
+				out += available;
+				size -= available;
+			}
+			return ok;
+		}
+
+		bool
+		get(void* ptr, usize size)
+		{
+			if(get_raw(ptr, size) == false)
+				return false;
+			crc = crc32_slurp(crc, ptr, size);
+			return true;
+		}
+
+		template<typename T>
+		bool
+		get(T& value)
+		{
+			return get(&value, sizeof(value));
+		}
+
+		bool
+		get_string(String& str, usize max_size)
+		{
+			u16 size = 0;
+			if(get(size) == false || size > max_size)
+				return ok = false;
+
+			auto data = alloc<byte>(size);
+			if(get(data.ptr, size) == false)
+			{
+				free(data);
+				return false;
+			}
+			str = String(std::move(data));
+			return true;
+		}
+	};
+
+	struct Delta_Entry
+	{
+		//index of the entry in the archive header
+		usize file;
+		u64 hash;
+		u64 size;
+	};
+
+	//sorts the named entries of the archive by their names for the path lookups
+	static Dynamic_Array<usize>
+	_names_sort(const Pensieve& archive)
+	{
+		Dynamic_Array<usize> result;
+		const auto& files = archive.header.files;
+		for(usize i = 0; i < files.count(); ++i)
+			if(files[i].name.empty() == false)
+				result.insert_back(i);
+
+		if(result.empty() == false)
+			std::sort(&result[0], &result[0] + result.count(), [&files](usize a, usize b){
+				return _name_less(files[a].name, files[b].name);
+			});
+		return result;
+	}
+
+	static Virtual_Handle
+	_name_find(const Pensieve& archive, const Dynamic_Array<usize>& sorted, const String& name)
+	{
+		if(sorted.empty())
+			return INVALID_FILE_HANDLE;
+
+		const auto& files = archive.header.files;
+		auto it = std::lower_bound(&sorted[0], &sorted[0] + sorted.count(), name, [&files](usize a, const String& b){
+			return _name_less(files[a].name, b);
+		});
+		if(it == &sorted[0] + sorted.count() || files[*it].name != name)
+			return INVALID_FILE_HANDLE;
+		return Virtual_Handle { *it };
+	}
+
+	//reads the whole file content, works for the lazy files without fetching them into the archive
+	static bool
+	_file_load(const Pensieve& archive, Virtual_Handle handle, Owner<byte>& data)
+	{
+		if(data.ptr)
+			free(data);
+
+		u64 size = archive.file_size(handle);
+		data = alloc<byte>(usize(size));
+		return archive.file_read(handle, 0, make_slice(data.ptr, usize(size))) == size;
+	}
+
+	//the hash and size matches are confirmed against the old content
+	static bool
+	_file_equal(const Pensieve& archive, Virtual_Handle handle, const Owner<byte>& data, Owner<byte>& scratch)
+	{
+		if(_file_load(archive, handle, scratch) == false || scratch.size != data.size)
+			return false;
+		return data.size == 0 || ::memcmp(scratch.ptr, data.ptr, data.size) == 0;
+	}
+
+	static u32
+	_entry_checksum(u32 crc, const String& name)
+	{
+		return crc32_slurp(crc, name.data(), name.size());
+	}
+
+	//crc of the paths and contents of the named entries in the header order, the patch keeps it for the new archive
+	static bool
+	_archive_checksum(const Pensieve& archive, Owner<byte>& buffer, u32& crc)
+	{
+		crc = 0;
+		for(usize i = 0; i < archive.header.files.count(); ++i)
+		{
+			const auto& entry = archive.header.files[i];
+			if(entry.name.empty())
+				continue;
+
+			crc = _entry_checksum(crc, entry.name);
+			u64 size = archive.file_size(Virtual_Handle { i });
+			for(u64 done = 0; done < size; )
+			{
+				usize part = usize(size - done < buffer.size ? size - done : buffer.size);
+				if(archive.file_read(Virtual_Handle { i }, done, make_slice(buffer.ptr, part)) != part)
+					return false;
+				crc = crc32_slurp(crc, buffer.ptr, part);
+				done += part;
+			}
+		}
+		return true;
+	}
+
+	static bool
+	_archive_fingerprint(const char* path, u64& size, u64& hash)
+	{
+		Disk_File file = disk_open(path, IO_MODE::READ);
+		if(file.valid() == false)
+			return false;
+
+		Memory_Stream block;
+		bool result = archive_header_read(file, block);
+		size = disk_size(file);
+		auto data = block.bin_content();
+		hash = hash64(data.ptr, data.size);
+		disk_close(file);
+		return result;
+	}
+
+	//the blocks grow with the base so big files don't get too many of them
+	static usize
+	_delta_block_size(u64 base_size)
+	{
+		usize result = 512;
+		while(result < 64 * 1024 && u64(result) * result < base_size)
+			result *= 2;
+		return result;
+	}
+
+	//adler like checksum which can be rolled one byte at a time
+	struct Rolling_Hash
+	{
+		u32 a;
+		u32 b;
+
+		void
+		init(const byte* ptr, usize size)
+		{
+			a = 0;
+			b = 0;
+			for(usize i = 0; i < size; ++i)
+			{
+				a += ptr[i];
+				b += u32(size - i) * ptr[i];
+			}
+		}
+
+		void
+		roll(byte out, byte in, usize size)
+		{
+			a = a - out + in;
+			b = b - u32(size) * out + a;
+		}
+
+		u32
+		value() const
+		{
+			return (a & 0xFFFF) | (b << 16);
+		}
+	};
+
+	static usize
+	_weak_bucket(u32 weak, usize mask)
+	{
+		return usize((u64(weak) * 0x9E3779B97F4A7C15ULL) >> 32) & mask;
+	}
+
+	static void
+	_emit_copy(IO_Trait* io, u64 offset, u64 size, Delta_Stats* stats)
+	{
+		//the copies are capped so their size fits the instruction
+		while(size > 0)
+		{
+			u32 part = size > 0x40000000 ? 0x40000000 : u32(size);
+			vprintb(io, DELTA_INST_COPY, offset, part);
+			offset += part;
+			size -= part;
+			if(stats)
+				stats->reused_bytes += part;
+		}
+	}
+
+	static void
+	_emit_literal(IO_Trait* io, const byte* ptr, u64 size, Delta_Stats* stats)
+	{
+		while(size > 0)
+		{
+			u32 part = size > 0x40000000 ? 0x40000000 : u32(size);
+			vprintb(io, DELTA_INST_LITERAL, part, make_slice(const_cast<byte*>(ptr), part));
+			ptr += part;
+			size -= part;
+			if(stats)
+				stats->literal_bytes += part;
+		}
+	}
+
+	void
+	delta_encode(File_View<byte> base, File_View<byte> data, usize block_size, IO_Trait* io, Delta_Stats* stats)
+	{
+		usize blocks_count = block_size ? base.count / block_size : 0;
+
+		//the blocks of the base are chained in buckets by their weak hash, the first block of a chain is the first in the base
+		usize capacity = 1;
+		while(capacity < blocks_count * 2)
+			capacity *= 2;
+		Dynamic_Array<usize> heads;
+		Dynamic_Array<usize> chain;
+		Dynamic_Array<u32> weaks;
+		heads.reserve(capacity);
+		chain.reserve(blocks_count);
+		weaks.reserve(blocks_count);
+		for(usize i = 0; i < capacity; ++i)
+			heads.insert_back(usize(-1));
+		for(usize i = 0; i < blocks_count; ++i)
+		{
+			Rolling_Hash h;
+			h.init(base.ptr + i * block_size, block_size);
+			weaks.insert_back(h.value());
+			chain.insert_back(usize(-1));
+		}
+		for(usize i = blocks_count; i > 0; --i)
+		{
+			usize bucket = _weak_bucket(weaks[i - 1], capacity - 1);
+			chain[i - 1] = heads[bucket];
+			heads[bucket] = i - 1;
+		}
+
+		u64 copy_offset = 0, copy_size = 0;
+		usize literal_start = 0;
+		usize position = 0;
+		Rolling_Hash h{};
+		if(blocks_count > 0 && data.count >= block_size)
+			h.init(data.ptr, block_size);
+
+		while(blocks_count > 0 && position + block_size <= data.count)
+		{
+			const byte* window = data.ptr + position;
+
+			//the block right after the last copy is the most likely match
+			usize match = usize(-1);
+			usize expected = usize((copy_offset + copy_size) / block_size);
+			if(copy_size > 0 && literal_start == position && (copy_offset + copy_size) % block_size == 0 && expected < blocks_count &&
+			   weaks[expected] == h.value() && ::memcmp(base.ptr + expected * block_size, window, block_size) == 0)
+				match = expected;
+
+			for(usize b = heads[_weak_bucket(h.value(), capacity - 1)]; match == usize(-1) && b != usize(-1); b = chain[b])
+				if(weaks[b] == h.value() && ::memcmp(base.ptr + b * block_size, window, block_size) == 0)
+					match = b;
+
+			if(match == usize(-1))
+			{
+				if(position + block_size < data.count)
+					h.roll(window[0], window[block_size], block_size);
+				++position;
+				continue;
+			}
+
+			//adjacent copies are merged into one instruction
+			u64 offset = u64(match) * block_size;
+			if(literal_start < position)
+			{
+				_emit_copy(io, copy_offset, copy_size, stats);
+				copy_size = 0;
+				_emit_literal(io, data.ptr + literal_start, position - literal_start, stats);
+			}
+			if(copy_size > 0 && copy_offset + copy_size == offset)
+			{
+				copy_size += block_size;
+			}
+			else
+			{
+				_emit_copy(io, copy_offset, copy_size, stats);
+				copy_offset = offset;
+				copy_size = block_size;
+			}
+
+			position += block_size;
+			literal_start = position;
+			if(position + block_size <= data.count)
+				h.init(data.ptr + position, block_size);
+		}
+
+		_emit_copy(io, copy_offset, copy_size, stats);
+		_emit_literal(io, data.ptr + literal_start, data.count - literal_start, stats);
+		vprintb(io, DELTA_INST_END);
+	}
+
+	bool
+	archive_diff(const char* old_path, const char* new_path, const char* patch_path, Delta_Stats* stats)
+	{
+		Pensieve old_archive, new_archive;
+		if(old_archive.mount_from_disk(old_path) != Pensieve::ERROR_OK ||
+		   new_archive.mount_from_disk(new_path) != Pensieve::ERROR_OK)
+			return false;
+
+		u64 old_size = 0, old_hash = 0;
+		if(_archive_fingerprint(old_path, old_size, old_hash) == false)
+			return false;
+
+		Delta_Stats local_stats{};
+		if(stats == nullptr)
+			stats = &local_stats;
+
+		//every old file is hashed so the moved and duplicated files are found by their content
+		Owner<byte> data, base;
+		Dynamic_Array<Delta_Entry> old_entries;
+		for(usize i = 0; i < old_archive.header.files.count(); ++i)
+		{
+			if(old_archive.header.files[i].name.empty())
+				continue;
+			if(_file_load(old_archive, Virtual_Handle { i }, data) == false)
+			{
+				free(data);
+				return false;
+			}
+			old_entries.insert_back(Delta_Entry{ i, hash64(data.ptr, data.size), data.size });
+		}
+		if(old_entries.empty() == false)
+			std::sort(&old_entries[0], &old_entries[0] + old_entries.count(), [](const Delta_Entry& a, const Delta_Entry& b){
+				return a.hash < b.hash || (a.hash == b.hash && a.size < b.size);
+			});
+		auto old_names = _names_sort(old_archive);
+
+		auto file = File::open(patch_path);
+		if(file.error != OS_ERROR::OK)
+		{
+			free(data);
+			return false;
+		}
+
+		Patch_Writer writer{ file.value, Memory_Stream(), 0, true };
+		writer.put(PATCH_MAGIC);
+		writer.crc = 0;
+		writer.put(PATCH_MAJOR);
+		writer.put(PATCH_MINOR);
+		writer.put(old_size);
+		writer.put(old_hash);
+
+		const auto& new_files = new_archive.header.files;
+		u32 files_count = 0;
+		for(const auto& entry: new_files)
+			if(entry.name.empty() == false)
+				++files_count;
+		writer.put(files_count);
+
+		bool result = true;
+		u32 archive_crc = 0;
+		Memory_Stream delta;
+		for(usize i = 0; i < new_files.count() && result; ++i)
+		{
+			const auto& entry = new_files[i];
+			if(entry.name.empty())
+				continue;
+
+			if(_file_load(new_archive, Virtual_Handle { i }, data) == false)
+			{
+				result = false;
+				break;
+			}
+			u64 hash = hash64(data.ptr, data.size);
+			archive_crc = _entry_checksum(archive_crc, entry.name);
+			archive_crc = crc32_slurp(archive_crc, data.ptr, data.size);
+
+			writer.put_string(entry.name);
+			u8 tags_size = u8(entry.tags.size());
+			writer.put(entry.flags);
+			writer.put(entry.mtime);
+			writer.put(tags_size);
+			writer.put(entry.tags.data(), tags_size);
+
+			auto same = _name_find(old_archive, old_names, entry.name);
+			const Delta_Entry* match = nullptr;
+			if(old_entries.empty() == false)
+			{
+				Delta_Entry key{ 0, hash, data.size };
+				auto end = &old_entries[0] + old_entries.count();
+				auto first = std::lower_bound(&old_entries[0], end, key, [](const Delta_Entry& a, const Delta_Entry& b){
+					return a.hash < b.hash || (a.hash == b.hash && a.size < b.size);
+				});
+				auto last = first;
+				while(last != end && last->hash == hash && last->size == data.size)
+					++last;
+
+				//the old file with the same path is preferred when it has the same content
+				if(same.valid())
+					for(auto it = first; it != last && match == nullptr; ++it)
+						if(it->file == same.header_entry_index && _file_equal(old_archive, same, data, base))
+							match = it;
+				for(auto it = first; it != last && match == nullptr; ++it)
+					if((same.valid() == false || it->file != same.header_entry_index) &&
+					   _file_equal(old_archive, Virtual_Handle { it->file }, data, base))
+						match = it;
+			}
+
+			if(match && same.valid() && match->file == same.header_entry_index)
+			{
+				writer.put(DELTA_OP_KEEP);
+				++stats->kept;
+				continue;
+			}
+
+			if(match)
+			{
+				writer.put(DELTA_OP_COPY);
+				writer.put_string(old_archive.header.files[match->file].name);
+				++stats->copied;
+				continue;
+			}
+
+			//modified files are encoded against their old content if that's smaller than storing them
+			if(same.valid() && data.size > 0 && old_archive.file_size(same) > 0)
+			{
+				if(_file_load(old_archive, same, base) == false)
+				{
+					result = false;
+					break;
+				}
+
+				Delta_Stats entry_stats{};
+				delta.clear();
+				delta_encode(File_View<byte>{ base.ptr, base.size }, File_View<byte>{ data.ptr, data.size }, _delta_block_size(base.size), delta, &entry_stats);
+				if(delta.size() < data.size)
+				{
+					writer.put(DELTA_OP_DELTA);
+					writer.put_string(entry.name);
+					writer.put(u64(data.size));
+					auto bytes = delta.bin_content();
+					writer.put(bytes.ptr, bytes.size);
+					++stats->deltas;
+					stats->reused_bytes += entry_stats.reused_bytes;
+					stats->literal_bytes += entry_stats.literal_bytes;
+					continue;
+				}
+			}
+
+			writer.put(DELTA_OP_DATA);
+			writer.put(u64(data.size));
+			writer.put(data.ptr, data.size);
+			++stats->added;
+			stats->literal_bytes += data.size;
+		}
+
+		writer.put(archive_crc);
+		u32 crc = writer.crc;
+		writer.put(crc);
+		writer.flush();
+
+		if(data.ptr)
+			free(data);
+		if(base.ptr)
+			free(base);
+		return result && writer.ok;
+	}
+
+	//streams one spooled content from the spool file into the save
+	struct Spool_Source
+	{
+		IO_Trait _io_trait;
+		Disk_File file;
+		u64 offset;
+		u64 end;
+	};
+
+	static usize
+	_spool_read(void* self, Slice<byte>& data)
+	{
+		Spool_Source* source = static_cast<Spool_Source*>(self);
+		usize size = usize(source->end - source->offset < data.size ? source->end - source->offset : data.size);
+		usize result = disk_read_at(source->file, source->offset, make_slice(data.ptr, size));
+		source->offset += result;
+		return result;
+	}
+
+	static usize
+	_spool_write(void*, const Slice<byte>&)
+	{
+		return 0;
+	}
+
+	struct Spool_Entry
+	{
+		usize content;
+		u64 offset;
+		u64 size;
+	};
+
+	bool
+	archive_patch(const char* old_path, const char* patch_path, const char* new_path)
+	{
+		#define ASSERT_FAIL(...) if((__VA_ARGS__) == false) { result = false; break; }
+
+		u64 old_size = 0, old_hash = 0;
+		if(_archive_fingerprint(old_path, old_size, old_hash) == false)
+			return false;
+
+		Pensieve archive;
+		if(archive.mount_from_disk(old_path) != Pensieve::ERROR_OK)
+			return false;
+		auto old_names = _names_sort(archive);
+
+		auto file = File::open(patch_path, IO_MODE::READ, OPEN_MODE::OPEN_ONLY);
+		if(file.error != OS_ERROR::OK)
+			return false;
+
+		//the new and modified contents are written to a spool file beside the new archive instead of memory
+		//and the save streams them from it, so the memory use doesn't grow with the size of the changes
+		usize path_size = ::strlen(new_path);
+		auto spool_path = alloc<char>(path_size + 7);
+		::memcpy(spool_path.ptr, new_path, path_size);
+		::memcpy(spool_path.ptr + path_size, ".spool", 7);
+		Disk_File spool = disk_open(spool_path.ptr, IO_MODE::WRITE);
+		if(spool.valid() == false)
+		{
+			free(spool_path);
+			return false;
+		}
+		u64 spool_size = 0;
+		Dynamic_Array<Spool_Entry> spooled;
+
+		Patch_Reader reader{ file.value, alloc<byte>(64 * 1024), 0, 0, 0, true };
+		auto buffer = alloc<byte>(64 * 1024);
+		auto spool_put = [&spool, &spool_size](const byte* ptr, usize size) {
+			if(disk_write_at(spool, spool_size, make_slice(const_cast<byte*>(ptr), size)) != size)
+				return false;
+			spool_size += size;
+			return true;
+		};
+
+		//the new header points to the old contents of the kept files and to new contents for the rest
+		Header next;
+		u32 archive_crc = 0;
+		bool has_archive_crc = false;
+		bool result = true;
+		do
+		{
+			u32 magic = 0;
+			u16 major = 0, minor = 0;
+			u64 patch_old_size = 0, patch_old_hash = 0;
+			u32 files_count = 0;
+			reader.get_raw(&magic, sizeof(magic));
+			ASSERT_FAIL(reader.ok && magic == PATCH_MAGIC);
+			ASSERT_FAIL(reader.get(major) && reader.get(minor) && major <= PATCH_MAJOR);
+			ASSERT_FAIL(reader.get(patch_old_size) && reader.get(patch_old_hash));
+			ASSERT_FAIL(patch_old_size == old_size && patch_old_hash == old_hash);
+			ASSERT_FAIL(reader.get(files_count));
+
+			for(u32 i = 0; i < files_count && result; ++i)
+			{
+				String name, tags;
+				u8 flags = 0, tags_size = 0, op = 0;
+				u64 mtime = 0;
+				ASSERT_FAIL(reader.get_string(name, 0xFFFF) && valid_path(name.all()));
+				ASSERT_FAIL(reader.get(flags) && reader.get(mtime) && reader.get(tags_size));
+
+				auto tags_data = alloc<byte>(tags_size);
+				bool tags_ok = reader.get(tags_data.ptr, tags_size);
+				tags = String(std::move(tags_data));
+				ASSERT_FAIL(tags_ok && reader.get(op));
+
+				usize index = usize(-1);
+				if(op == DELTA_OP_KEEP || op == DELTA_OP_COPY)
+				{
+					String old_name;
+					if(op == DELTA_OP_COPY)
+						ASSERT_FAIL(reader.get_string(old_name, 0xFFFF));
+					auto old = _name_find(archive, old_names, op == DELTA_OP_KEEP ? name : old_name);
+					ASSERT_FAIL(old.valid());
+					index = archive.header.files[old.header_entry_index].index;
+				}
+				else if(op == DELTA_OP_DATA)
+				{
+					u64 size = 0;
+					ASSERT_FAIL(reader.get(size));
+
+					u64 start = spool_size;
+					for(u64 done = 0; done < size && reader.ok; )
+					{
+						usize part = usize(size - done < buffer.size ? size - done : buffer.size);
+						if(reader.get(buffer.ptr, part) && spool_put(buffer.ptr, part) == false)
+							reader.ok = false;
+						done += part;
+					}
+					ASSERT_FAIL(reader.ok);
+
+					index = archive._content_create();
+					spooled.insert_back(Spool_Entry{ index, start, size });
+				}
+				else if(op == DELTA_OP_DELTA)
+				{
+					String base_name;
+					u64 size = 0;
+					ASSERT_FAIL(reader.get_string(base_name, 0xFFFF) && reader.get(size));
+					auto old = _name_find(archive, old_names, base_name);
+					ASSERT_FAIL(old.valid());
+					u64 base_size = archive.file_size(old);
+
+					//the copies are read from the old archive in pieces instead of loading the whole base
+					u64 start = spool_size;
+					u8 inst = DELTA_INST_END;
+					while(reader.get(inst) && inst != DELTA_INST_END)
+					{
+						if(inst == DELTA_INST_COPY)
+						{
+							u64 offset = 0;
+							u32 part = 0;
+							if(reader.get(offset) == false || reader.get(part) == false)
+								break;
+							if(offset > base_size || part > base_size - offset)
+							{
+								reader.ok = false;
+								break;
+							}
+							for(u32 done = 0; done < part && reader.ok; )
+							{
+								usize piece = part - done < buffer.size ? part - done : buffer.size;
+								if(archive.file_read(old, offset + done, make_slice(buffer.ptr, piece)) != piece ||
+								   spool_put(buffer.ptr, piece) == false)
+									reader.ok = false;
+								done += u32(piece);
+							}
+						}
+						else if(inst == DELTA_INST_LITERAL)
+						{
+							u32 part = 0;
+							if(reader.get(part) == false)
+								break;
+							for(u32 done = 0; done < part && reader.ok; )
+							{
+								usize piece = part - done < buffer.size ? part - done : buffer.size;
+								if(reader.get(buffer.ptr, piece) && spool_put(buffer.ptr, piece) == false)
+									reader.ok = false;
+								done += u32(piece);
+							}
+						}
+						else
+						{
+							reader.ok = false;
+						}
+					}
+					ASSERT_FAIL(reader.ok && inst == DELTA_INST_END && spool_size - start == size);
+
+					index = archive._content_create();
+					spooled.insert_back(Spool_Entry{ index, start, size });
+				}
+				else
+				{
+					ASSERT_FAIL(false);
+				}
+
+				next.files.insert_back(File_Header_Entry{ name, index, flags, mtime, tags });
+			}
+			if(result == false)
+				break;
+
+			//the checksum of the new archive comes with minor version 1
+			if(minor >= 1)
+			{
+				ASSERT_FAIL(reader.get(archive_crc));
+				has_archive_crc = true;
+			}
+
+			u32 expected = reader.crc;
+			u32 crc = 0;
+			ASSERT_FAIL(reader.get_raw(&crc, sizeof(crc)) && crc == expected);
+		} while(false);
+
+		free(reader.buffer);
+		disk_close(spool);
+
+		Dynamic_Array<Spool_Source> sources;
+		if(result)
+		{
+			spool = disk_open(spool_path.ptr, IO_MODE::READ);
+			result = spool.valid();
+		}
+		if(result)
+		{
+			//the sources array isn't grown after this so the contents can point into it
+			sources.reserve(spooled.count());
+			for(const auto& entry: spooled)
+			{
+				Spool_Source source{};
+				source._io_trait._read = _spool_read;
+				source._io_trait._write = _spool_write;
+				source.file = spool;
+				source.offset = entry.offset;
+				source.end = entry.offset + entry.size;
+				sources.insert_back(source);
+			}
+			for(usize i = 0; i < spooled.count(); ++i)
+			{
+				sources[i]._io_trait._self = &sources[i];
+				archive.content[spooled[i].content].source = &sources[i]._io_trait;
+				archive.content[spooled[i].content].size = spooled[i].size;
+			}
+
+			//the old contents which no new file points to are released
+			for(auto& c: archive.content)
+				c.refs = 0;
+			for(const auto& entry: next.files)
+				++archive.content[entry.index].refs;
+			for(usize i = 0; i < archive.content.count(); ++i)
+			{
+				if(archive.content[i].refs == 0)
+				{
+					archive.content[i].refs = 1;
+					archive._content_release(i);
+				}
+			}
+			archive.header = std::move(next);
+
+			//the kept files are streamed from the old archive and the new ones from the spool
+			result = archive.save_on_disk(new_path);
+		}
+
+		disk_close(spool);
+		disk_remove(spool_path.ptr);
+		free(spool_path);
+
+		//the written archive is read back and checked against the checksum of the archive the patch was made from
+		if(result && has_archive_crc)
+		{
+			Pensieve written;
+			u32 crc = 0;
+			result = written.mount_from_disk(new_path) == Pensieve::ERROR_OK &&
+					 _archive_checksum(written, buffer, crc) && crc == archive_crc;
+			if(result == false)
+			{
+				disk_close(written.disk);
+				disk_remove(new_path);
+			}
+		}
+		free(buffer);
+		return result;
+
+		#undef ASSERT_FAIL
+	}
+}
@@ -0,0 +1,179 @@
+#include "pensieve/Disk.h"
+
+#if defined(OS_WINDOWS)
+	#define WIN32_LEAN_AND_MEAN
+	#include <Windows.h>
+#elif defined(OS_LINUX)
+	#include <fcntl.h>
+	#include <unistd.h>
+	#include <sys/stat.h>
+	#include <errno.h>
+	#include <stdio.h>
+#endif
+
+namespace pnsv
+{
+	#if defined(OS_WINDOWS)
+
+	Disk_File
+	disk_open(const char* path, IO_MODE mode)
+	{
+		HANDLE h = INVALID_HANDLE_VALUE;
+		if(mode == IO_MODE::READ)
+			h = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL,
+							OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		else
+			h = CreateFileA(path, GENERIC_WRITE, 0, NULL,
+							CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+
+		if(h == INVALID_HANDLE_VALUE)
+			return INVALID_DISK_FILE;
+		return Disk_File { isize(h) };
+	}
+
+	void
+	disk_close(Disk_File& file)
+	{
+		if(file.valid())
+			CloseHandle(HANDLE(file.handle));
+		file = INVALID_DISK_FILE;
+	}
+
+	u64
+	disk_size(Disk_File file)
+	{
+		LARGE_INTEGER size{};
+		if(GetFileSizeEx(HANDLE(file.handle), &size) == FALSE)
+			return 0;
+		return u64(size.QuadPart);
+	}
+
+	bool
+	disk_rename(const char* from, const char* to)
+	{
+		return MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING) != FALSE;
+	}
+
+	bool
+	disk_remove(const char* path)
+	{
+		return DeleteFileA(path) != FALSE;
+	}
+
+	usize
+	disk_read_at(Disk_File file, u64 offset, Slice<byte> data)
+	{
+		usize done = 0;
+		while(done < data.size)
+		{
+			OVERLAPPED ov{};
+			ov.Offset = DWORD((offset + done) & 0xFFFFFFFF);
+			ov.OffsetHigh = DWORD((offset + done) >> 32);
+
+			DWORD request = DWORD(data.size - done > 0x40000000 ? 0x40000000 : data.size - done);
+			DWORD result = 0;
+			if(ReadFile(HANDLE(file.handle), data.ptr + done, request, &result, &ov) == FALSE || result == 0)
+				break;
+			done += result;
+		}
+		return done;
+	}
+
+	usize
+	disk_write_at(Disk_File file, u64 offset, Slice<byte> data)
+	{
+		usize done = 0;
+		while(done < data.size)
+		{
+			OVERLAPPED ov{};
+			ov.Offset = DWORD((offset + done) & 0xFFFFFFFF);
+			ov.OffsetHigh = DWORD((offset + done) >> 32);
+
+			DWORD request = DWORD(data.size - done > 0x40000000 ? 0x40000000 : data.size - done);
+			DWORD result = 0;
+			if(WriteFile(HANDLE(file.handle), data.ptr + done, request, &result, &ov) == FALSE || result == 0)
+				break;
+			done += result;
+		}
+		return done;
+	}
+
+	#elif defined(OS_LINUX)
+
+	Disk_File
+	disk_open(const char* path, IO_MODE mode)
+	{
+		int fd = -1;
+		if(mode == IO_MODE::READ)
+			fd = ::open(path, O_RDONLY | O_CLOEXEC);
+		else
+			fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+		if(fd == -1)
+			return INVALID_DISK_FILE;
+		return Disk_File { isize(fd) };
+	}
+
+	void
+	disk_close(Disk_File& file)
+	{
+		if(file.valid())
+			::close(int(file.handle));
+		file = INVALID_DISK_FILE;
+	}
+
+	u64
+	disk_size(Disk_File file)
+	{
+		struct stat st{};
+		if(::fstat(int(file.handle), &st) != 0)
+			return 0;
+		return u64(st.st_size);
+	}
+
+	bool
+	disk_rename(const char* from, const char* to)
+	{
+		return ::rename(from, to) == 0;
+	}
+
+	bool
+	disk_remove(const char* path)
+	{
+		return ::unlink(path) == 0;
+	}
+
+	usize
+	disk_read_at(Disk_File file, u64 offset, Slice<byte> data)
+	{
+		usize done = 0;
+		while(done < data.size)
+		{
+			ssize_t result = ::pread(int(file.handle), data.ptr + done, data.size - done, off_t(offset + done));
+			if(result < 0 && errno == EINTR)
+				continue;
+			if(result <= 0)
+				break;
+			done += usize(result);
+		}
+		return done;
+	}
+
+	usize
+	disk_write_at(Disk_File file, u64 offset, Slice<byte> data)
+	{
+		usize done = 0;
+		while(done < data.size)
+		{
+			ssize_t result = ::pwrite(int(file.handle), data.ptr + done, data.size - done, off_t(offset + done));
+			if(result < 0 && errno == EINTR)
+				continue;
+			if(result <= 0)
+				break;
+			done += usize(result);
+		}
+		return done;
+	}
+
+	#endif
+}
@@ -0,0 +1,138 @@
+#include "pensieve/Overlay.h"
+
+#include <algorithm>
+
+namespace pnsv
+{
+	Pensieve::ERROR_CODE
+	Overlay::mount(const char* path)
+	{
+		layers.emplace_back();
+		auto result = layers[layers.count() - 1].mount_from_disk(path);
+		if(result != Pensieve::ERROR_OK)
+			layers.remove_back();
+		return result;
+	}
+
+	Overlay_Handle
+	Overlay::_file_lookup(const String& path) const
+	{
+		for(usize i = layers.count(); i > 0; --i)
+		{
+			//the layers headers are probed directly since their whiteouts are hidden from file_open
+			const Pensieve& layer = layers[i - 1];
+			auto handle = layer.header.file_exists(path);
+			if(handle.valid() == false)
+				continue;
+
+			if(layer.file_is_whiteout(handle))
+				return INVALID_OVERLAY_HANDLE;
+			return Overlay_Handle { i - 1, handle };
+		}
+		return INVALID_OVERLAY_HANDLE;
+	}
+
+	Overlay_Handle
+	Overlay::file_open(const String& path)
+	{
+		assert(valid_path(path.all()));
+		auto handle = _file_lookup(path);
+		//the entry is found through the layer header so the layer trace is recorded here
+		if(handle.valid() && layers[handle.layer].trace)
+			layers[handle.layer].trace->record(path);
+		return handle;
+	}
+
+	bool
+	Overlay::file_exists(const String& path) const
+	{
+		assert(valid_path(path.all()));
+		return _file_lookup(path).valid();
+	}
+
+	const String&
+	Overlay::file_name(Overlay_Handle handle) const
+	{
+		assert(layers.count() > handle.layer);
+		return layers[handle.layer].file_name(handle.handle);
+	}
+
+	u64
+	Overlay::file_size(Overlay_Handle handle) const
+	{
+		assert(layers.count() > handle.layer);
+		return layers[handle.layer].file_size(handle.handle);
+	}
+
+	File_Stat
+	Overlay::file_stat(Overlay_Handle handle) const
+	{
+		assert(layers.count() > handle.layer);
+		return layers[handle.layer].file_stat(handle.handle);
+	}
+
+	Memory_Stream&
+	Overlay::file_stream(Overlay_Handle handle)
+	{
+		assert(layers.count() > handle.layer);
+		return layers[handle.layer].file_stream(handle.handle);
+	}
+
+	usize
+	Overlay::file_read(Overlay_Handle handle, u64 offset, Slice<byte> data) const
+	{
+		assert(layers.count() > handle.layer);
+		return layers[handle.layer].file_read(handle.handle, offset, data);
+	}
+
+	Dynamic_Array<Overlay_Handle>
+	Overlay::files_match(const String& pattern) const
+	{
+		Dynamic_Array<Overlay_Handle> matches;
+		for(usize i = 0; i < layers.count(); ++i)
+			for(const auto& handle: layers[i].header.files_match(pattern))
+				matches.insert_back(Overlay_Handle { i, handle });
+
+		//the same path from all the layers ends up next to each other with the topmost layer first
+		const auto& l = layers;
+		if(matches.empty() == false)
+			std::sort(&matches[0], &matches[0] + matches.count(), [&l](const Overlay_Handle& a, const Overlay_Handle& b){
+				const String& a_name = l[a.layer].file_name(a.handle);
+				const String& b_name = l[b.layer].file_name(b.handle);
+				if(_name_less(a_name, b_name))
+					return true;
+				if(_name_less(b_name, a_name))
+					return false;
+				return a.layer > b.layer;
+			});
+
+		Dynamic_Array<Overlay_Handle> result;
+		for(usize i = 0; i < matches.count(); ++i)
+		{
+			const auto& match = matches[i];
+			if(i > 0 && file_name(matches[i - 1]) == file_name(match))
+				continue;
+			if(layers[match.layer].file_is_whiteout(match.handle))
+				continue;
+			result.insert_back(match);
+		}
+		return result;
+	}
+
+	bool
+	Overlay::files_read_batch(const Dynamic_Array<Overlay_Handle>& handles)
+	{
+		bool result = true;
+		for(usize i = 0; i < layers.count(); ++i)
+		{
+			Dynamic_Array<Virtual_Handle> layer_handles;
+			for(const auto& handle: handles)
+				if(handle.layer == i)
+					layer_handles.insert_back(handle.handle);
+
+			if(layer_handles.empty() == false)
+				result &= layers[i].files_read_batch(layer_handles);
+		}
+		return result;
+	}
+}
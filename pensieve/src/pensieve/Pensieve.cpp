@@ -2,6 +2,11 @@
 
 #include <cpprelude/File.h>
 
+#include <algorithm>
+#include <new>
+#include <string.h>
+#include <time.h>
+
 namespace pnsv
 {
 	bool
@@ -116,6 +121,7 @@ namespace pnsv
 				path.pop_front();
 			}
 		}
+		return true;
 	}
 
 	static u32*
@@ -166,6 +172,477 @@ namespace pnsv
 		return c ^ 0xFFFFFFFF;
 	}
 
+	constexpr static u64 XXH_PRIME64_1 = 0x9E3779B185EBCA87ULL;
+	constexpr static u64 XXH_PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+	constexpr static u64 XXH_PRIME64_3 = 0x165667B19E3779F9ULL;
+	constexpr static u64 XXH_PRIME64_4 = 0x85EBCA77C2B2AE63ULL;
+	constexpr static u64 XXH_PRIME64_5 = 0x27D4EB2F165667C5ULL;
+
+	inline static u64
+	_rotl64(u64 x, u32 r)
+	{
+		return (x << r) | (x >> (64 - r));
+	}
+
+	inline static u64
+	_read64(const u8* ptr)
+	{
+		u64 value;
+		::memcpy(&value, ptr, sizeof(value));
+		return value;
+	}
+
+	inline static u32
+	_read32(const u8* ptr)
+	{
+		u32 value;
+		::memcpy(&value, ptr, sizeof(value));
+		return value;
+	}
+
+	inline static u64
+	_xxh_round(u64 acc, u64 input)
+	{
+		acc += input * XXH_PRIME64_2;
+		acc = _rotl64(acc, 31);
+		return acc * XXH_PRIME64_1;
+	}
+
+	inline static u64
+	_xxh_merge_round(u64 acc, u64 value)
+	{
+		acc ^= _xxh_round(0, value);
+		return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+	}
+
+	u64
+	hash64(const void* ptr, usize size, u64 seed)
+	{
+		const u8* p = static_cast<const u8*>(ptr);
+		const u8* end = p + size;
+		u64 h = 0;
+
+		if(size >= 32)
+		{
+			u64 v1 = seed + XXH_PRIME64_1 + XXH_PRIME64_2;
+			u64 v2 = seed + XXH_PRIME64_2;
+			u64 v3 = seed;
+			u64 v4 = seed - XXH_PRIME64_1;
+
+			const u8* limit = end - 32;
+			do
+			{
+				v1 = _xxh_round(v1, _read64(p)); p += 8;
+				v2 = _xxh_round(v2, _read64(p)); p += 8;
+				v3 = _xxh_round(v3, _read64(p)); p += 8;
+				v4 = _xxh_round(v4, _read64(p)); p += 8;
+			} while(p <= limit);
+
+			h = _rotl64(v1, 1) + _rotl64(v2, 7) + _rotl64(v3, 12) + _rotl64(v4, 18);
+			h = _xxh_merge_round(h, v1);
+			h = _xxh_merge_round(h, v2);
+			h = _xxh_merge_round(h, v3);
+			h = _xxh_merge_round(h, v4);
+		}
+		else
+		{
+			h = seed + XXH_PRIME64_5;
+		}
+
+		h += u64(size);
+
+		for(; p + 8 <= end; p += 8)
+		{
+			h ^= _xxh_round(0, _read64(p));
+			h = _rotl64(h, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+		}
+
+		if(p + 4 <= end)
+		{
+			h ^= u64(_read32(p)) * XXH_PRIME64_1;
+			h = _rotl64(h, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+			p += 4;
+		}
+
+		for(; p < end; ++p)
+		{
+			h ^= u64(*p) * XXH_PRIME64_5;
+			h = _rotl64(h, 11) * XXH_PRIME64_1;
+		}
+
+		h ^= h >> 33;
+		h *= XXH_PRIME64_2;
+		h ^= h >> 29;
+		h *= XXH_PRIME64_3;
+		h ^= h >> 32;
+		return h;
+	}
+
+	bool
+	_name_less(const String& a, const String& b)
+	{
+		auto x = a.all().bytes;
+		auto y = b.all().bytes;
+		usize size = x.size < y.size ? x.size : y.size;
+		int cmp = size == 0 ? 0 : ::memcmp(x.ptr, y.ptr, size);
+		if(cmp != 0)
+			return cmp < 0;
+		return x.size < y.size;
+	}
+
+
+	//a single disk read which covers the chunks of indices[first, last)
+	struct Fetch_Span
+	{
+		u64 start;
+		u64 end;
+		usize first;
+		usize last;
+	};
+
+	struct Async_Batch
+	{
+		Pensieve* pensieve;
+		Dynamic_Array<usize> indices;
+		usize remaining;
+		bool ok;
+		Pensieve_Callback callback;
+		void* user_data;
+		//empty request which completes the batch when it has nothing to read
+		Async_Request done;
+	};
+
+	struct Async_Span_Read
+	{
+		Async_Request request;
+		Async_Batch* batch;
+		Fetch_Span span;
+		Owner<byte> buffer;
+	};
+
+	struct Async_Save
+	{
+		Pensieve* pensieve;
+		Disk_File file;
+		//the archive is written to the temp path and moved over the target path once all the writes are done
+		Owner<char> path;
+		Owner<char> temp_path;
+		Memory_Stream header;
+		Dynamic_Array<u64> sizes;
+		Dynamic_Array<Async_Request> requests;
+		usize remaining;
+		bool ok;
+		Pensieve_Callback callback;
+		void* user_data;
+	};
+
+	struct Parallel_Fetch
+	{
+		Pensieve* pensieve;
+		const Dynamic_Array<usize>* indices;
+		const Pensieve_Task* task;
+		bool verify;
+		std::atomic<bool> ok;
+		std::atomic<bool> cancelled;
+	};
+
+	struct Parallel_Span
+	{
+		Parallel_Fetch* fetch;
+		Fetch_Span span;
+	};
+
+	//the operation tasks aren't waited on through a group, their own task tracks them
+	static Task_Group _operation_tasks;
+
+	//sorts the lazy chunks by their disk offset and merges the near ones into spans
+	static void
+	_coalesce_spans(Pensieve& self, Dynamic_Array<usize>& indices, Dynamic_Array<Fetch_Span>& spans)
+	{
+		if(indices.empty())
+			return;
+
+		auto& content = self.content;
+		std::sort(&indices[0], &indices[0] + indices.count(), [&content](usize a, usize b){
+			return content[a].offset < content[b].offset;
+		});
+
+		usize i = 0;
+		while(i < indices.count())
+		{
+			//extend the span while the next chunk is near enough to be worth reading through the gap
+			Fetch_Span span{};
+			span.first = i;
+			span.start = content[indices[i]].offset;
+			span.end = span.start + sizeof(u64) + content[indices[i]].size;
+
+			usize j = i + 1;
+			for(; j < indices.count(); ++j)
+			{
+				const auto& next = content[indices[j]];
+				u64 next_end = next.offset + sizeof(u64) + next.size;
+				if(next.offset > span.end + BATCH_GAP_SIZE || next_end - span.start > BATCH_SPAN_SIZE)
+					break;
+				if(next_end > span.end)
+					span.end = next_end;
+			}
+
+			span.last = j;
+			spans.insert_back(span);
+			i = j;
+		}
+	}
+
+	//splits the span data into the files streams
+	static bool
+	_split_span(Pensieve& self, const Dynamic_Array<usize>& indices, const Fetch_Span& span, const byte* buffer)
+	{
+		bool result = true;
+		for(usize k = span.first; k < span.last; ++k)
+		{
+			auto& c = self.content[indices[k]];
+			if(c.lazy == false)
+				continue;
+
+			const byte* chunk = buffer + (c.offset - span.start);
+			u64 bin_size = 0;
+			::memcpy(&bin_size, chunk, sizeof(bin_size));
+			if(bin_size != c.size)
+			{
+				result = false;
+				continue;
+			}
+
+			c.bin.clear();
+			vprintb(c.bin, make_slice(const_cast<byte*>(chunk) + sizeof(u64), usize(c.size)));
+			c.bin.move_to_start();
+			c.lazy = false;
+		}
+		return result;
+	}
+
+	//checks the stored sizes of the span chunks without keeping their content
+	static bool
+	_verify_span(const Pensieve& self, const Dynamic_Array<usize>& indices, const Fetch_Span& span, const byte* buffer)
+	{
+		for(usize k = span.first; k < span.last; ++k)
+		{
+			const auto& c = self.content[indices[k]];
+			u64 bin_size = 0;
+			::memcpy(&bin_size, buffer + (c.offset - span.start), sizeof(bin_size));
+			if(bin_size != c.size)
+				return false;
+		}
+		return true;
+	}
+
+	static void
+	_parallel_span_run(void* user_data)
+	{
+		Parallel_Span* read = static_cast<Parallel_Span*>(user_data);
+		Parallel_Fetch* fetch = read->fetch;
+		if(fetch->task && fetch->task->cancelled.load())
+		{
+			fetch->cancelled.store(true);
+			return;
+		}
+		if(fetch->ok.load() == false)
+			return;
+
+		Pensieve& self = *fetch->pensieve;
+		usize span_size = usize(read->span.end - read->span.start);
+		auto buffer = alloc<byte>(span_size);
+		bool result = self._data_read(self.data_offset + read->span.start, make_slice(buffer.ptr, span_size)) == span_size;
+		if(result && fetch->verify)
+			result = _verify_span(self, *fetch->indices, read->span, buffer.ptr);
+		else if(result)
+			result = _split_span(self, *fetch->indices, read->span, buffer.ptr);
+		free(buffer);
+
+		if(result == false)
+			fetch->ok.store(false);
+	}
+
+	static void
+	_operation_start(Pensieve_Task& task, Pensieve* self, const char* path, Task_Function function)
+	{
+		assert(task.done.load() && "the task is still running another operation");
+		task.pensieve = self;
+		task.path = String(path ? path : "");
+		task.error = Pensieve::ERROR_OK;
+		task.cancelled.store(false);
+		task.done.store(false);
+
+		task.pool = thread_pool();
+		if(task.pool)
+			task.pool->submit(_operation_tasks, function, &task);
+		else
+			function(&task);
+	}
+
+	static void
+	_load_operation_run(void* user_data)
+	{
+		Pensieve_Task& task = *static_cast<Pensieve_Task*>(user_data);
+		Pensieve& self = *task.pensieve;
+		if(task.cancelled.load())
+		{
+			task._finish(Pensieve::ERROR_CANCELLED);
+			return;
+		}
+
+		//an already mounted archive gets its file back once the new content is fetched, like load_from_volumes does
+		//and its id is set aside so the new mount doesn't evict its cached blocks
+		Disk_File mounted_disk = self.disk;
+		Volume_Set* mounted_volumes = self.volumes;
+		u64 mounted_offset = self.data_offset;
+		u64 mounted_id = self.archive_id;
+		bool mounted = mounted_disk.valid() || mounted_volumes;
+		self.disk = INVALID_DISK_FILE;
+		self.volumes = nullptr;
+		if(mounted)
+			self.archive_id = 0;
+
+		usize first_file = self.header.files.count();
+		usize first_content = self.content.count();
+		Pensieve::ERROR_CODE err = self.mount_from_disk(task.path.data());
+		if(err == Pensieve::ERROR_OK)
+		{
+			Dynamic_Array<usize> indices;
+			for(usize i = first_content; i < self.content.count(); ++i)
+				if(self.content[i].lazy)
+					indices.insert_back(i);
+			err = self._content_fetch_parallel(indices, &task, false);
+
+			//a cancelled load stays mounted unless it has to give the file back to the mounted archive
+			if(err != Pensieve::ERROR_OK && (err != Pensieve::ERROR_CANCELLED || mounted))
+				self._load_rollback(first_file, first_content);
+			if(mounted)
+				disk_close(self.disk);
+			else
+				self._disk_release();
+		}
+
+		if(mounted)
+		{
+			//nothing reads from the loaded file anymore so its cached blocks go
+			if(self.cache && self.archive_id != 0)
+				self.cache->evict(self.archive_id);
+			self.disk = mounted_disk;
+			self.volumes = mounted_volumes;
+			self.data_offset = mounted_offset;
+			self.archive_id = mounted_id;
+		}
+		task._finish(err);
+	}
+
+	static void
+	_save_operation_run(void* user_data)
+	{
+		Pensieve_Task& task = *static_cast<Pensieve_Task*>(user_data);
+		if(task.cancelled.load())
+		{
+			task._finish(Pensieve::ERROR_CANCELLED);
+			return;
+		}
+
+		bool result = task.pensieve->save_on_disk(task.path.data());
+		task._finish(result ? Pensieve::ERROR_OK : Pensieve::ERROR_WRITE_FAILED);
+	}
+
+	static void
+	_verify_operation_run(void* user_data)
+	{
+		Pensieve_Task& task = *static_cast<Pensieve_Task*>(user_data);
+		Pensieve& self = *task.pensieve;
+		if(task.cancelled.load())
+		{
+			task._finish(Pensieve::ERROR_CANCELLED);
+			return;
+		}
+
+		Dynamic_Array<usize> indices;
+		for(usize i = 0; i < self.content.count(); ++i)
+			if(self.content[i].lazy)
+				indices.insert_back(i);
+		task._finish(self._content_fetch_parallel(indices, &task, true));
+	}
+
+	//the async state outlives the call which started it so it's allocated and released explicitly
+	template<typename T>
+	static T*
+	_async_state_new()
+	{
+		return ::new(alloc<T>().ptr) T{};
+	}
+
+	template<typename T>
+	static void
+	_async_state_free(T* state)
+	{
+		state->~T();
+		free(Owner<T>(state, 1));
+	}
+
+	static void
+	_async_batch_done(Async_Request* request)
+	{
+		Async_Batch* batch = static_cast<Async_Batch*>(request->user_data);
+		batch->callback(batch->pensieve, batch->ok, batch->user_data);
+		_async_state_free(batch);
+	}
+
+	static void
+	_async_span_read_done(Async_Request* request)
+	{
+		Async_Span_Read* read = static_cast<Async_Span_Read*>(request->user_data);
+		Async_Batch* batch = read->batch;
+
+		if(request->result != request->data.size ||
+		   _split_span(*batch->pensieve, batch->indices, read->span, read->buffer.ptr) == false)
+			batch->ok = false;
+
+		free(read->buffer);
+		_async_state_free(read);
+
+		if(--batch->remaining == 0)
+		{
+			batch->callback(batch->pensieve, batch->ok, batch->user_data);
+			_async_state_free(batch);
+		}
+	}
+
+	static void
+	_async_save_done(Async_Request* request)
+	{
+		Async_Save* save = static_cast<Async_Save*>(request->user_data);
+		if(request->result != request->data.size)
+			save->ok = false;
+
+		if(--save->remaining == 0)
+		{
+			disk_close(save->file);
+			if(save->ok)
+				save->ok = disk_rename(save->temp_path.ptr, save->path.ptr);
+			if(save->ok == false)
+				disk_remove(save->temp_path.ptr);
+			free(save->path);
+			free(save->temp_path);
+			save->callback(save->pensieve, save->ok, save->user_data);
+			_async_state_free(save);
+		}
+	}
+
+	//the path with .tmp appended where the saves write before replacing the target
+	static Owner<char>
+	_temp_path(const char* path)
+	{
+		usize path_size = ::strlen(path);
+		auto temp_path = alloc<char>(path_size + 5);
+		::memcpy(temp_path.ptr, path, path_size);
+		::memcpy(temp_path.ptr + path_size, ".tmp", 5);
+		return temp_path;
+	}
 
 	Header::Header()
 		:deleted_files_count(0)
@@ -181,6 +658,11 @@ namespace pnsv
 				if(files[i].name.empty())
 				{
 					--deleted_files_count;
+					files[i].name = path;
+					files[i].index = index;
+					files[i].flags = 0;
+					files[i].mtime = u64(::time(nullptr));
+					files[i].tags = String();
 					return Virtual_Handle { i };
 				}
 			}
@@ -188,7 +670,10 @@ namespace pnsv
 
 		files.insert_back(File_Header_Entry{
 			path,
-			index
+			index,
+			0,
+			u64(::time(nullptr)),
+			String()
 		});
 		return Virtual_Handle { files.count() - 1 };
 	}
@@ -241,33 +726,212 @@ namespace pnsv
 	}
 
 
+	template<typename TRead>
+	static bool
+	_header_block_read(TRead&& read_at, u64 file_size, Memory_Stream& block)
+	{
+		block.clear();
+
+		byte prefix[16];
+		usize prefix_size = read_at(0, make_slice(prefix, sizeof(prefix)));
+		if(prefix_size == 0)
+			return false;
+
+		//every version has the data length right after the signature, the rest of the file is the header and the chunks sizes
+		u64 block_size = prefix_size;
+		if(prefix_size == sizeof(prefix))
+		{
+			u64 data_length = 0;
+			::memcpy(&data_length, prefix + 8, sizeof(data_length));
+			if(data_length <= file_size - prefix_size)
+				block_size = file_size - data_length;
+		}
+
+		auto buffer = alloc<byte>(usize(block_size));
+		usize read_size = read_at(0, make_slice(buffer.ptr, usize(block_size)));
+		vprintb(block, make_slice(buffer.ptr, read_size));
+		block.move_to_start();
+		free(buffer);
+		return read_size == block_size;
+	}
+
+	bool
+	archive_header_read(Disk_File file, Memory_Stream& block)
+	{
+		auto read_at = [file](u64 offset, Slice<byte> data) { return disk_read_at(file, offset, data); };
+		return _header_block_read(read_at, disk_size(file), block);
+	}
+
+	bool
+	archive_header_read(const Volume_Set& volumes, Memory_Stream& block)
+	{
+		auto read_at = [&volumes](u64 offset, Slice<byte> data) { return volumes.read(offset, data); };
+		return _header_block_read(read_at, volumes.size, block);
+	}
+
+	Pensieve::Pensieve()
+		:disk(INVALID_DISK_FILE),
+		 volumes(nullptr),
+		 data_offset(0),
+		 inline_threshold(DEFAULT_INLINE_THRESHOLD),
+		 cache(nullptr),
+		 archive_id(0),
+		 trace(nullptr),
+		 layout(nullptr)
+	{}
+
+	Pensieve::Pensieve(Pensieve&& other)
+		:header(std::move(other.header)),
+		 content(std::move(other.content)),
+		 disk(other.disk),
+		 volumes(other.volumes),
+		 data_offset(other.data_offset),
+		 inline_threshold(other.inline_threshold),
+		 cache(other.cache),
+		 archive_id(other.archive_id),
+		 trace(other.trace),
+		 layout(other.layout)
+	{
+		other.disk = INVALID_DISK_FILE;
+		other.volumes = nullptr;
+		other.archive_id = 0;
+	}
+
+	Pensieve&
+	Pensieve::operator=(Pensieve&& other)
+	{
+		if(cache && archive_id != 0)
+			cache->evict(archive_id);
+		disk_close(disk);
+		for(usize i = 0; i < content.count(); ++i)
+			_content_drop_external(i);
+		header = std::move(other.header);
+		content = std::move(other.content);
+		disk = other.disk;
+		volumes = other.volumes;
+		data_offset = other.data_offset;
+		inline_threshold = other.inline_threshold;
+		cache = other.cache;
+		archive_id = other.archive_id;
+		trace = other.trace;
+		layout = other.layout;
+		other.disk = INVALID_DISK_FILE;
+		other.volumes = nullptr;
+		other.archive_id = 0;
+		return *this;
+	}
+
+	Pensieve::~Pensieve()
+	{
+		if(cache && archive_id != 0)
+			cache->evict(archive_id);
+		disk_close(disk);
+		for(usize i = 0; i < content.count(); ++i)
+			_content_drop_external(i);
+	}
+
 	Virtual_Handle
 	Pensieve::file_create_open(const String& path)
 	{
 		assert(valid_path(path.all()));
 
 		Virtual_Handle handle = header.file_exists(path);
-		if(handle.valid()) handle;
-		
-		content.emplace_back();
-		return header.file_create(path, content.count() - 1);
+		if(handle.valid() && file_is_whiteout(handle) == false) return handle;
+
+		//a file created over a whiteout replaces it
+		if(handle.valid())
+			file_remove(handle);
+		return header.file_create(path, _content_create());
 	}
 
 	Virtual_Handle
 	Pensieve::file_create(const String& path)
 	{
 		assert(valid_path(path.all()));
-		if(header.file_exists(path).valid())
+		auto handle = header.file_exists(path);
+		if(handle.valid() && file_is_whiteout(handle) == false)
 			return INVALID_FILE_HANDLE;
 
-		content.emplace_back();
-		return header.file_create(path, content.count() - 1);
+		//a file created over a whiteout replaces it
+		if(handle.valid())
+			file_remove(handle);
+		return header.file_create(path, _content_create());
+	}
+
+	Virtual_Handle
+	Pensieve::file_create_from_stream(const String& path, IO_Trait* source, u64 size)
+	{
+		auto handle = file_create(path);
+		if(handle.valid() == false)
+			return handle;
+
+		auto& c = content[header.files[handle.header_entry_index].index];
+		c.source = source;
+		c.size = size;
+		return handle;
+	}
+
+	Virtual_Handle
+	Pensieve::file_create_from(const String& path, Owner<byte>&& buffer)
+	{
+		auto handle = file_create(path);
+		if(handle.valid() == false)
+		{
+			free(buffer);
+			return handle;
+		}
+
+		auto& c = content[header.files[handle.header_entry_index].index];
+		c.external = buffer.ptr;
+		c.size = buffer.size;
+		c.owned = std::move(buffer);
+		return handle;
+	}
+
+	Virtual_Handle
+	Pensieve::file_create_borrowed(const String& path, const byte* data, usize size)
+	{
+		auto handle = file_create(path);
+		if(handle.valid() == false)
+			return handle;
+
+		auto& c = content[header.files[handle.header_entry_index].index];
+		c.external = data;
+		c.size = size;
+		return handle;
+	}
+
+	Virtual_Handle
+	Pensieve::file_whiteout(const String& path)
+	{
+		assert(valid_path(path.all()));
+
+		auto handle = header.file_exists(path);
+		if(handle.valid())
+			file_remove(handle);
+
+		handle = file_create(path);
+		header.files[handle.header_entry_index].flags |= ENTRY_FLAG_WHITEOUT;
+		return handle;
+	}
+
+	bool
+	Pensieve::file_is_whiteout(Virtual_Handle handle) const
+	{
+		assert(header.files.count() > handle.header_entry_index);
+		return header.files[handle.header_entry_index].flags & ENTRY_FLAG_WHITEOUT;
 	}
 
 	Virtual_Handle
 	Pensieve::file_open(const String& path)
 	{
-		return header.file_exists(path);
+		auto handle = header.file_exists(path);
+		//whiteouts only have a meaning for the overlays which read them from the header
+		if(handle.valid() && file_is_whiteout(handle))
+			return INVALID_FILE_HANDLE;
+		if(trace && handle.valid())
+			trace->record(header.files[handle.header_entry_index].name);
+		return handle;
 	}
 
 	void
@@ -275,7 +939,13 @@ namespace pnsv
 	{
 		assert(header.files.count() > handle.header_entry_index);
 
-		content[header.files[handle.header_entry_index].index].bin.clear();
+		usize index = _file_detach(handle, false);
+		auto& c = content[index];
+		c.bin.clear();
+		c.lazy = false;
+		c.source = nullptr;
+		_content_drop_external(index);
+		header.files[handle.header_entry_index].mtime = u64(::time(nullptr));
 	}
 
 	const String&
@@ -289,6 +959,8 @@ namespace pnsv
 	Pensieve::file_stream(Virtual_Handle handle) const
 	{
 		assert(header.files.count() > handle.header_entry_index);
+		assert(content[header.files[handle.header_entry_index].index].lazy == false);
+		assert(content[header.files[handle.header_entry_index].index].external == nullptr);
 		return content[header.files[handle.header_entry_index].index].bin;
 	}
 
@@ -296,7 +968,150 @@ namespace pnsv
 	Pensieve::file_stream(Virtual_Handle handle)
 	{
 		assert(header.files.count() > handle.header_entry_index);
-		return content[header.files[handle.header_entry_index].index].bin;
+		usize index = _file_detach(handle, true);
+		bool fetched = true;
+		if(content[index].lazy)
+			fetched = _file_fetch(index);
+		else if(content[index].source)
+			fetched = _content_pipe_source(index);
+		else if(content[index].external)
+			_content_copy_external(index);
+		assert(fetched && "failed to fetch the file content, use files_read_batch to handle the io errors");
+
+		//a failed fetch leaves the content lazy which would shadow the writes to the stream
+		if(fetched == false)
+		{
+			content[index].bin.clear();
+			content[index].lazy = false;
+		}
+		header.files[handle.header_entry_index].mtime = u64(::time(nullptr));
+		return content[index].bin;
+	}
+
+	File_View<byte>
+	Pensieve::_file_bytes(Virtual_Handle handle)
+	{
+		assert(header.files.count() > handle.header_entry_index);
+		//the view is read only so shared content doesn't need to be detached
+		usize index = header.files[handle.header_entry_index].index;
+		bool fetched = true;
+		if(content[index].lazy)
+			fetched = _file_fetch(index);
+		else if(content[index].source)
+			fetched = _content_pipe_source(index);
+		assert(fetched && "failed to fetch the file content, use files_read_batch to handle the io errors");
+		(void)fetched;
+
+		const Pensieve& self = *this;
+		return self._file_bytes(handle);
+	}
+
+	Slice<byte>
+	Pensieve::file_append_reserve(Virtual_Handle handle, usize bytes)
+	{
+		return make_slice(_file_append(handle, nullptr, bytes), bytes);
+	}
+
+	byte*
+	Pensieve::_file_append(Virtual_Handle handle, const void* data, usize size)
+	{
+		auto& stream = file_stream(handle);
+		stream.move_to_end();
+		usize start = stream.size();
+
+		if(data)
+		{
+			stream.write(make_slice(static_cast<const byte*>(data), size));
+		}
+		else
+		{
+			//grows the stream once with zeros instead of writing them through a buffer
+			stream._data.expand_back(size, 0);
+			stream.move_to_end();
+		}
+		return stream.bin_content().ptr + start;
+	}
+
+	File_View<byte>
+	Pensieve::_file_bytes(Virtual_Handle handle) const
+	{
+		assert(header.files.count() > handle.header_entry_index);
+		return _content_bytes(header.files[handle.header_entry_index].index);
+	}
+
+	File_View<byte>
+	Pensieve::_content_bytes(usize content_index) const
+	{
+		const auto& c = content[content_index];
+		if(c.external)
+			return File_View<byte>{ c.external, usize(c.size) };
+		if(c.lazy || c.source)
+			return File_View<byte>{ nullptr, 0, true };
+
+		auto data = c.bin.bin_content();
+		return File_View<byte>{ data.ptr, data.size };
+	}
+
+	u64
+	Pensieve::file_size(Virtual_Handle handle) const
+	{
+		assert(header.files.count() > handle.header_entry_index);
+		return _content_size(header.files[handle.header_entry_index].index);
+	}
+
+	File_Stat
+	Pensieve::file_stat(Virtual_Handle handle) const
+	{
+		assert(header.files.count() > handle.header_entry_index);
+		const auto& file = header.files[handle.header_entry_index];
+
+		File_Stat result{};
+		result.size = _content_size(file.index);
+		result.mtime = file.mtime;
+		result.flags = file.flags;
+		result.tags = file.tags.all();
+		return result;
+	}
+
+	void
+	Pensieve::file_set_mtime(Virtual_Handle handle, u64 mtime)
+	{
+		assert(header.files.count() > handle.header_entry_index);
+		header.files[handle.header_entry_index].mtime = mtime;
+	}
+
+	void
+	Pensieve::file_set_tags(Virtual_Handle handle, const String& tags)
+	{
+		assert(header.files.count() > handle.header_entry_index);
+		usize size = tags.size() > MAX_TAGS_SIZE ? MAX_TAGS_SIZE : tags.size();
+		auto tags_data = alloc<byte>(size);
+		::memcpy(tags_data.ptr, tags.data(), size);
+		header.files[handle.header_entry_index].tags = String(std::move(tags_data));
+	}
+
+	usize
+	Pensieve::file_read(Virtual_Handle handle, u64 offset, Slice<byte> data) const
+	{
+		assert(header.files.count() > handle.header_entry_index);
+		const auto& c = content[header.files[handle.header_entry_index].index];
+
+		u64 size = _content_size(header.files[handle.header_entry_index].index);
+		if(offset >= size || c.source)
+			return 0;
+		if(data.size > size - offset)
+			data.size = usize(size - offset);
+
+		if(c.lazy && cache && volumes == nullptr)
+			return cache->read(archive_id, disk, data_offset + c.offset + sizeof(u64) + offset, data);
+		if(c.lazy)
+			return _data_read(data_offset + c.offset + sizeof(u64) + offset, data);
+
+		if(c.external)
+			::memcpy(data.ptr, c.external + offset, data.size);
+		else
+			::memcpy(data.ptr, c.bin.bin_content().ptr + offset, data.size);
+		return data.size;
 	}
 
 	bool
@@ -304,7 +1119,8 @@ namespace pnsv
 	{
 		assert(valid_path(path.all()));
 
-		return header.file_exists(path).valid();
+		auto handle = header.file_exists(path);
+		return handle.valid() && file_is_whiteout(handle) == false;
 	}
 
 	bool
@@ -315,7 +1131,7 @@ namespace pnsv
 		usize index = header.file_remove(path);
 		if(index != usize(-1))
 		{
-			content[index].bin.reset();
+			_content_release(index);
 			return true;
 		}
 		return false;
@@ -328,7 +1144,7 @@ namespace pnsv
 		usize index = header.file_remove(handle);
 		if(index != usize(-1))
 		{
-			content[index].bin.reset();
+			_content_release(index);
 			return true;
 		}
 		return false;
@@ -337,102 +1153,549 @@ namespace pnsv
 	Dynamic_Array<Virtual_Handle>
 	Pensieve::files_match(const String& pattern) const
 	{
-		return header.files_match(pattern);
+		Dynamic_Array<Virtual_Handle> result;
+		for(const auto& handle: header.files_match(pattern))
+			if(file_is_whiteout(handle) == false)
+				result.insert_back(handle);
+		return result;
 	}
 
-	u64
-	Pensieve::total_data_size() const
+	bool
+	Pensieve::files_read_batch(const Dynamic_Array<Virtual_Handle>& handles)
+	{
+		Dynamic_Array<usize> indices;
+		indices.reserve(handles.count());
+		for(const auto& handle: handles)
+		{
+			assert(header.files.count() > handle.header_entry_index);
+			usize index = header.files[handle.header_entry_index].index;
+			if(content[index].lazy)
+				indices.insert_back(index);
+		}
+		return _content_fetch(indices);
+	}
+
+	bool
+	Pensieve::files_prefetch(const Access_Trace& trace)
+	{
+		return files_read_batch(_trace_handles(trace));
+	}
+
+	Pensieve_Stats
+	Pensieve::stats() const
+	{
+		Pensieve_Stats result{};
+
+		Dynamic_Array<bool> counted;
+		counted.reserve(content.count());
+		for(usize i = 0; i < content.count(); ++i)
+			counted.insert_back(false);
+
+		for(const auto& file: header.files)
+		{
+			if(file.name.empty())
+				continue;
+
+			u64 size = _content_size(file.index);
+
+			++result.files_count;
+			result.logical_size += size;
+			if(counted[file.index] == false)
+			{
+				counted[file.index] = true;
+				++result.chunks_count;
+				result.stored_size += size;
+			}
+		}
+		return result;
+	}
+
+	u64
+	Pensieve::total_data_size() const
 	{
 		u64 size = 0;
-		for(const auto& c: content)
-			size += c.bin.size();
+		for(usize i = 0; i < content.count(); ++i)
+			size += _content_size(i);
 		return size;
 	}
 
 	void
+	Pensieve::read_async(Async_IO& aio, const Dynamic_Array<Virtual_Handle>& handles,
+						 Pensieve_Callback callback, void* user_data)
+	{
+		Async_Batch* batch = _async_state_new<Async_Batch>();
+		batch->pensieve = this;
+		batch->ok = true;
+		batch->callback = callback;
+		batch->user_data = user_data;
+
+		batch->indices.reserve(handles.count());
+		for(const auto& handle: handles)
+		{
+			assert(header.files.count() > handle.header_entry_index);
+			usize index = header.files[handle.header_entry_index].index;
+			if(content[index].lazy)
+				batch->indices.insert_back(index);
+		}
+
+		Dynamic_Array<Fetch_Span> spans;
+		_coalesce_spans(*this, batch->indices, spans);
+
+		if(spans.empty() || disk.valid() == false)
+		{
+			//the volumes are read in parallel by their own threads so the batch is fetched right away
+			//and its callback is queued to keep it out of the submission
+			batch->ok = spans.empty() || (volumes && _content_fetch(batch->indices));
+			batch->done = Async_Request{ disk, 0, Slice<byte>(), false, 0, _async_batch_done, batch };
+			aio.submit(&batch->done);
+			return;
+		}
+
+		batch->remaining = spans.count();
+		for(const auto& span: spans)
+		{
+			Async_Span_Read* read = _async_state_new<Async_Span_Read>();
+			read->batch = batch;
+			read->span = span;
+			read->buffer = alloc<byte>(usize(span.end - span.start));
+
+			read->request.file = disk;
+			read->request.offset = data_offset + span.start;
+			read->request.data = read->buffer.all();
+			read->request.write = false;
+			read->request.callback = _async_span_read_done;
+			read->request.user_data = read;
+			aio.submit(&read->request);
+		}
+	}
+
+	bool
 	Pensieve::save_to_stream(IO_Trait* io)
 	{
+		//the streamed files can only be read once and the stream isn't mounted after the save so they are kept in memory
+		bool result = true;
+		for(usize i = 0; i < content.count(); ++i)
+			if(content[i].source && _content_pipe_source(i) == false)
+				result = false;
+		if(result == false)
+			return false;
+
+		Dynamic_Array<usize> chunks;
+		Dynamic_Array<u64> offsets;
+		Memory_Stream block;
+		_write_header(block, chunks, offsets);
+		return _write_chunks(io, block, chunks);
+	}
+
+	//returns false on a short write, a full disk for example
+	static bool
+	_flush_block(IO_Trait* io, Memory_Stream& block)
+	{
+		auto data = block.bin_content();
+		bool result = data.size == 0 || vprintb(io, data) == data.size;
+		block.clear();
+		return result;
+	}
+
+	bool
+	Pensieve::_write_chunks(IO_Trait* io, Memory_Stream& block, const Dynamic_Array<usize>& chunks)
+	{
+		Owner<byte> buffer;
+		bool result = true;
+		for(usize index: chunks)
+		{
+			//the small chunks which are in memory are gathered with the header into big writes
+			const auto& c = content[index];
+			if(c.lazy == false && c.source == nullptr && _content_size(index) < STREAM_BUFFER_SIZE)
+			{
+				if(_write_chunk(block, index, buffer) == false)
+					result = false;
+			}
+			else
+			{
+				if(_flush_block(io, block) == false || _write_chunk(io, index, buffer) == false)
+					result = false;
+			}
+
+			if(block.size() >= STREAM_BUFFER_SIZE && _flush_block(io, block) == false)
+				result = false;
+
+			//the file is already incomplete so the rest isn't written
+			if(result == false)
+				break;
+		}
+		if(result && _flush_block(io, block) == false)
+			result = false;
+
+		if(buffer.ptr)
+			free(buffer);
+		return result;
+	}
+
+	u64
+	Pensieve::_write_header(IO_Trait* io, Dynamic_Array<usize>& chunks, Dynamic_Array<u64>& offsets)
+	{
+		Dynamic_Array<usize> unique;
+		_dedup_contents(unique);
+		if(layout)
+			_layout_chunks(unique);
+
+		//small files are stored inside the header, lazy ones are fetched for that
+		Dynamic_Array<bool> inlined;
+		Dynamic_Array<usize> small_lazy;
+		inlined.reserve(content.count());
+		for(usize i = 0; i < content.count(); ++i)
+			inlined.insert_back(false);
+
+		for(usize index: unique)
+		{
+			//small external files are copied to be written like the other inline ones
+			if(content[index].external && content[index].size <= inline_threshold)
+				_content_copy_external(index);
+
+			const auto& c = content[index];
+			if(c.source == nullptr && _content_size(index) <= inline_threshold)
+			{
+				inlined[index] = true;
+				if(c.lazy)
+					small_lazy.insert_back(index);
+			}
+			else
+			{
+				chunks.insert_back(index);
+			}
+		}
+
+		//a failed fetch leaves the file lazy so it's written as a chunk instead
+		_content_fetch(small_lazy);
+		for(usize index: small_lazy)
+		{
+			if(content[index].lazy)
+			{
+				inlined[index] = false;
+				chunks.insert_back(index);
+			}
+		}
+
+		//offsets of the chunks indexed by the content index
+		offsets.reserve(content.count());
+		for(usize i = 0; i < content.count(); ++i)
+			offsets.insert_back(0);
+
+		u64 data_length = 0;
+		u64 acc = 0;
+		for(usize index: chunks)
+		{
+			u64 size = _content_size(index);
+			offsets[index] = acc;
+			data_length += size;
+
+			//+ sizeof(u64): for the sizes of the binary content chunks
+			acc += size + sizeof(u64);
+		}
+
+		u64 header_size = 8;
 		vprintb(io, MAGIC, MAJOR, MINOR);
 
 		u32 crc = 0;
 
-		u64 data_length = total_data_size();
 		vprintb(io, data_length);
 		crc = crc32_slurp(crc, &data_length, sizeof(data_length));
 
 		u32 files_count = header.files.count() - header.deleted_files_count;
 		vprintb(io, files_count);
 		crc = crc32_slurp(crc, &files_count, sizeof(files_count));
+		header_size += 8 + 4;
 
-		Dynamic_Array<Slice<byte>> bin_data;
-
-		u64 acc = 0;
 		for(const auto& file: header.files)
 		{
 			if(valid_path(file.name.all()) == false)
 				continue;
 
 			u16 filename_size = file.name.size();
-			vprintb(io, filename_size, file.name, acc);
+			u8 flags = file.flags;
+			if(inlined[file.index])
+				flags |= ENTRY_FLAG_INLINE;
+			vprintb(io, filename_size, file.name, flags);
 			crc = crc32_slurp(crc, &filename_size, sizeof(filename_size));
 			crc = crc32_slurp(crc, file.name.data(), file.name.size());
-			crc = crc32_slurp(crc, &acc, sizeof(acc));
+			crc = crc32_slurp(crc, &flags, sizeof(flags));
+			header_size += 2 + filename_size + 1;
+
+			u64 file_size = _content_size(file.index);
+			u8 tags_size = u8(file.tags.size());
+			vprintb(io, file_size, file.mtime, tags_size, file.tags);
+			crc = crc32_slurp(crc, &file_size, sizeof(file_size));
+			crc = crc32_slurp(crc, &file.mtime, sizeof(file.mtime));
+			crc = crc32_slurp(crc, &tags_size, sizeof(tags_size));
+			crc = crc32_slurp(crc, file.tags.data(), file.tags.size());
+			header_size += 8 + 8 + 1 + tags_size;
+
+			if(flags & ENTRY_FLAG_INLINE)
+			{
+				auto data = content[file.index].bin.bin_content();
+				u32 inline_size = u32(data.size);
+				vprintb(io, inline_size, data);
+				crc = crc32_slurp(crc, &inline_size, sizeof(inline_size));
+				crc = crc32_slurp(crc, data.ptr, data.size);
+				header_size += 4 + inline_size;
+			}
+			else
+			{
+				u64 offset = offsets[file.index];
+				vprintb(io, offset);
+				crc = crc32_slurp(crc, &offset, sizeof(offset));
+				header_size += 8;
+			}
+		}
 
-			bin_data.emplace_back(content[file.index].bin.bin_content());
+		vprintb(io, crc);
+		header_size += 4;
 
-			//+ sizeof(u64): for the sizes of the binary content chunks
-			acc += content[file.index].bin.size() + sizeof(u64);
+		return header_size;
+	}
+
+	bool
+	Pensieve::_write_chunk(IO_Trait* io, usize content_index, Owner<byte>& buffer)
+	{
+		auto& c = content[content_index];
+		u64 size = _content_size(content_index);
+		if(vprintb(io, size) != sizeof(size))
+			return false;
+
+		//the external memory is kept, save_on_disk switches it to the new archive once it's mounted
+		if(c.external)
+			return size == 0 || vprintb(io, make_slice(const_cast<byte*>(c.external), usize(size))) == size;
+
+		if(c.lazy == false && c.source == nullptr)
+		{
+			auto data = c.bin.bin_content();
+			return data.size == 0 || vprintb(io, data) == data.size;
 		}
 
-		vprintb(io, crc);
+		if(buffer.ptr == nullptr)
+			buffer = alloc<byte>(STREAM_BUFFER_SIZE);
 
-		for(const auto& bin: bin_data)
+		//a short source fails the save since the chunk size is already written
+		u64 done = 0;
+		while(done < size)
 		{
-			u64 bin_size = bin.size;
-			vprintb(io, bin_size, bin);
+			usize request = usize(size - done < buffer.size ? size - done : buffer.size);
+			auto data = make_slice(buffer.ptr, request);
+
+			usize read_size = 0;
+			if(c.lazy)
+				read_size = _data_read(data_offset + c.offset + sizeof(u64) + done, data);
+			else
+				read_size = vreadb(c.source, data);
+
+			if(read_size < request || vprintb(io, data) != request)
+				return false;
+			done += request;
 		}
+		return true;
 	}
 
 	bool
 	Pensieve::save_on_disk(const char* path)
 	{
-		auto result = File::open(path);
-		if(result.error != OS_ERROR::OK)
+		//the new file is written beside the target then moved over it, so a failed save leaves the target as it was
+		//and a mounted archive can keep reading from it meanwhile
+		auto temp_path = _temp_path(path);
+
+		Dynamic_Array<usize> chunks;
+		Dynamic_Array<u64> offsets;
+		Dynamic_Array<usize> streamed;
+		u64 header_size = 0;
+		bool result = true;
+		{
+			auto file = File::open(temp_path.ptr);
+			if(file.error != OS_ERROR::OK)
+			{
+				free(temp_path);
+				return false;
+			}
+
+			Memory_Stream block;
+			header_size = _write_header(block, chunks, offsets);
+			for(usize index: chunks)
+				if(content[index].source || content[index].external)
+					streamed.insert_back(index);
+			result = _write_chunks(file.value, block, chunks);
+		}
+
+		if(result)
+			result = disk_rename(temp_path.ptr, path);
+		if(result == false)
+			disk_remove(temp_path.ptr);
+		free(temp_path);
+		if(result == false)
+			return false;
+
+		//mount the new file, the lazy files chunks moved to their new offsets
+		//and the streamed and external files are read from it from now on
+		Disk_File new_disk = disk_open(path, IO_MODE::READ);
+		if(new_disk.valid() == false)
+			return false;
+
+		disk_close(disk);
+		disk = new_disk;
+		volumes = nullptr;
+		data_offset = header_size;
+		if(cache && archive_id != 0)
+			cache->evict(archive_id);
+		archive_id = archive_id_new();
+		for(usize index: chunks)
+		{
+			content[index].offset = offsets[index];
+			content[index].size = _content_size(index);
+		}
+		for(usize index: streamed)
+		{
+			_content_drop_external(index);
+			content[index].source = nullptr;
+			content[index].lazy = true;
+		}
+		return true;
+	}
+
+	bool
+	Pensieve::save_async(Async_IO& aio, const char* path, Pensieve_Callback callback, void* user_data)
+	{
+		if(_fetch_all() == false)
+			return false;
+
+		//like save_on_disk the target is only replaced once the whole archive is written
+		auto temp_path = _temp_path(path);
+		Disk_File file = disk_open(temp_path.ptr, IO_MODE::WRITE);
+		if(file.valid() == false)
+		{
+			free(temp_path);
 			return false;
-		save_to_stream(result.value);
+		}
+
+		usize path_size = ::strlen(path);
+		Async_Save* save = _async_state_new<Async_Save>();
+		save->pensieve = this;
+		save->file = file;
+		save->path = alloc<char>(path_size + 1);
+		::memcpy(save->path.ptr, path, path_size + 1);
+		save->temp_path = std::move(temp_path);
+		save->ok = true;
+		save->callback = callback;
+		save->user_data = user_data;
+
+		Dynamic_Array<usize> chunks;
+		Dynamic_Array<u64> offsets;
+		u64 offset = _write_header(save->header, chunks, offsets);
+
+		//the requests are pointed to by the async io so they should never move after submission
+		save->sizes.reserve(chunks.count());
+		save->requests.reserve(1 + chunks.count() * 2);
+		save->requests.insert_back(Async_Request{ file, 0, save->header.bin_content(), true, 0, _async_save_done, save });
+
+		for(usize index: chunks)
+		{
+			//the async io only reads from the write requests data
+			auto bytes = _content_bytes(index);
+			auto bin = make_slice(const_cast<byte*>(bytes.ptr), bytes.count);
+			save->sizes.insert_back(u64(bin.size));
+			Slice<byte> size_data = make_slice(reinterpret_cast<byte*>(&save->sizes[save->sizes.count() - 1]), sizeof(u64));
+			save->requests.insert_back(Async_Request{ file, offset, size_data, true, 0, _async_save_done, save });
+			offset += sizeof(u64);
+
+			if(bin.size > 0)
+				save->requests.insert_back(Async_Request{ file, offset, bin, true, 0, _async_save_done, save });
+			offset += bin.size;
+		}
+
+		save->remaining = save->requests.count();
+		for(auto& request: save->requests)
+			aio.submit(&request);
+		return true;
 	}
 
 	Pensieve::ERROR_CODE
 	Pensieve::load_from_stream(IO_Trait* io)
+	{
+		u16 major = 0, minor = 0;
+		ERROR_CODE err = _load_signature(io, major, minor);
+		if(err != ERROR_OK)
+			return err;
+
+		usize first_file = header.files.count();
+		usize first_content = content.count();
+
+		usize first_chunk = 0;
+		u64 data_length = 0, header_size = 0;
+		switch (major)
+		{
+			//version 2 only allows the files to share chunks, version 3 adds the entries flags and version 4 their metadata
+			case 1:
+			case 2:
+			case 3:
+			case 4:
+				err = _load_header(io, major, data_length, header_size, first_chunk);
+				break;
+
+			default:
+				return ERROR_INCOMPATIBLE_MAJOR_VERSION;
+		}
+
+		if(err == ERROR_OK)
+			err = _load_chunks(io, first_chunk);
+		if(err != ERROR_OK)
+			_load_rollback(first_file, first_content);
+		return err;
+	}
+
+	Pensieve::ERROR_CODE
+	Pensieve::_load_signature(IO_Trait* io, u16& major, u16& minor)
 	{
 		#define ASSERT_FAIL(err, ...) if((__VA_ARGS__) == false) return (err);
-		
+
 		u32 magic = 0;
 		ASSERT_FAIL(ERROR_FILE_CORRUPTED, vreadb(io, magic) == 4);
 		ASSERT_FAIL(ERROR_NOT_PNSV_FILE, magic == MAGIC);
 
-		u16 major = 0, minor = 0;
 		ASSERT_FAIL(ERROR_FILE_CORRUPTED, vreadb(io, major, minor) == 4);
 		ASSERT_FAIL(ERROR_INCOMPATIBLE_MAJOR_VERSION, major <= MAJOR);
 
-		switch (major)
+		return ERROR_OK;
+		#undef ASSERT_FAIL
+	}
+
+	Pensieve::ERROR_CODE
+	Pensieve::_load_chunks(IO_Trait* io, usize first_chunk)
+	{
+		#define ASSERT_FAIL(err, ...) if((__VA_ARGS__) == false) return (err);
+
+		//the contents are created in the order of their chunks on disk
+		for(usize i = first_chunk; i < content.count(); ++i)
 		{
-			case 1:
-				return _load_version_1(io);
+			auto& c = content[i];
 
-			default:
-				return ERROR_INCOMPATIBLE_MAJOR_VERSION;
+			u64 bin_size = 0;
+			ASSERT_FAIL(ERROR_FILE_CORRUPTED, vreadb(io, bin_size) == 8);
+			ASSERT_FAIL(ERROR_FILE_CORRUPTED, bin_size == c.size);
+			if(bin_size > 0)
+			{
+				ASSERT_FAIL(ERROR_FILE_CORRUPTED, c.bin.pipe_in(io, bin_size) == bin_size);
+				c.bin.move_to_start();
+			}
 		}
 
+		return ERROR_OK;
 		#undef ASSERT_FAIL
 	}
 
 	Pensieve::ERROR_CODE
-	Pensieve::_load_version_1(IO_Trait* io)
+	Pensieve::_load_header(IO_Trait* io, u16 major, u64& data_length, u64& header_size, usize& first_chunk)
 	{
 		#define ASSERT_FAIL(err, ...) if((__VA_ARGS__) == false) return (err);
 
-		u64 data_length = 0;
+		usize first_file = header.files.count();
+
 		ASSERT_FAIL(ERROR_FILE_CORRUPTED, vreadb(io, data_length) == 8);
 		u32 c = crc32_slurp(0, &data_length, 8);
 
@@ -440,6 +1703,15 @@ namespace pnsv
 		ASSERT_FAIL(ERROR_FILE_CORRUPTED, vreadb(io, files_count) == 4);
 		c = crc32_slurp(c, &files_count, 4);
 
+		header_size = 8 + 4;
+
+		//offsets of the files which are stored in chunks
+		Dynamic_Array<u64> offsets;
+		Dynamic_Array<usize> chunked;
+		//sizes of the chunked files as stored in the version 4 entries
+		//the count isn't trusted before the crc is checked so the arrays grow with the parsed entries
+		Dynamic_Array<u64> sizes;
+
 		for(usize i = 0; i < files_count; ++i)
 		{
 			u16 filename_size = 0;
@@ -453,34 +1725,137 @@ namespace pnsv
 				return ERROR_FILE_CORRUPTED;
 			}
 			c = crc32_slurp(c, filename_data.ptr, filename_data.size);
-			//insert the files
-			content.emplace_back();
+
+			//insert the files, the chunked ones get their content once all the offsets are known
 			header.files.insert_back(File_Header_Entry{
 				std::move(filename_data),
-				content.count() - 1
+				usize(-1),
+				0,
+				0,
+				String()
 			});
+			header_size += 2 + filename_size;
+
+			u8 flags = 0;
+			if(major >= 3)
+			{
+				ASSERT_FAIL(ERROR_FILE_CORRUPTED, vreadb(io, flags) == 1);
+				c = crc32_slurp(c, &flags, 1);
+				header_size += 1;
+				header.files[first_file + i].flags = flags & ~ENTRY_FLAG_INLINE;
+			}
+
+			u64 file_size = 0;
+			if(major >= 4)
+			{
+				u64 mtime = 0;
+				u8 tags_size = 0;
+				ASSERT_FAIL(ERROR_FILE_CORRUPTED, vreadb(io, file_size, mtime, tags_size) == 17);
+				c = crc32_slurp(c, &file_size, 8);
+				c = crc32_slurp(c, &mtime, 8);
+				c = crc32_slurp(c, &tags_size, 1);
+
+				auto tags_data = alloc<byte>(tags_size);
+				if(vreadb(io, tags_data.all()) != tags_size)
+				{
+					free(tags_data);
+					return ERROR_FILE_CORRUPTED;
+				}
+				c = crc32_slurp(c, tags_data.ptr, tags_data.size);
+
+				header.files[first_file + i].mtime = mtime;
+				header.files[first_file + i].tags = String(std::move(tags_data));
+				header_size += 17 + tags_size;
+			}
 
-			u64 file_offset = 0;
-			ASSERT_FAIL(ERROR_FILE_CORRUPTED, vreadb(io, file_offset) == 8);
-			c = crc32_slurp(c, &file_offset, 8);
+			if(flags & ENTRY_FLAG_INLINE)
+			{
+				u32 inline_size = 0;
+				ASSERT_FAIL(ERROR_FILE_CORRUPTED, vreadb(io, inline_size) == 4);
+				c = crc32_slurp(c, &inline_size, 4);
+				ASSERT_FAIL(ERROR_FILE_CORRUPTED, major < 4 || inline_size == file_size);
+
+				usize index = _content_create();
+				header.files[first_file + i].index = index;
+				auto& file_content = content[index];
+				if(inline_size > 0)
+				{
+					ASSERT_FAIL(ERROR_FILE_CORRUPTED, file_content.bin.pipe_in(io, inline_size) == inline_size);
+					c = crc32_slurp(c, file_content.bin.bin_content().ptr, inline_size);
+					file_content.bin.move_to_start();
+				}
+				header_size += 4 + inline_size;
+			}
+			else
+			{
+				u64 file_offset = 0;
+				ASSERT_FAIL(ERROR_FILE_CORRUPTED, vreadb(io, file_offset) == 8);
+				c = crc32_slurp(c, &file_offset, 8);
+				header_size += 8;
+
+				offsets.insert_back(file_offset);
+				chunked.insert_back(first_file + i);
+				sizes.insert_back(file_size);
+			}
 		}
 
 		u32 crc = 0;
 		ASSERT_FAIL(ERROR_FILE_CORRUPTED, vreadb(io, crc) == 4);
+		header_size += 4;
 
 		ASSERT_FAIL(ERROR_HEADER_CORRUPTED, c == crc);
 
-		for(usize i = 0; i < files_count; ++i)
+		//files with the same offset share the content, and the contents are created in the disk order
+		first_chunk = content.count();
+
+		Dynamic_Array<usize> order;
+		order.reserve(chunked.count());
+		for(usize i = 0; i < chunked.count(); ++i)
+			order.insert_back(i);
+
+		if(order.empty() == false)
 		{
-			u64 bin_size = 0;
-			ASSERT_FAIL(ERROR_FILE_CORRUPTED, vreadb(io, bin_size) == 8);
-			if(bin_size > 0)
+			std::sort(&order[0], &order[0] + order.count(), [&offsets](usize a, usize b){
+				return offsets[a] < offsets[b];
+			});
+		}
+
+		for(usize i = 0; i < order.count(); ++i)
+		{
+			if(i == 0 || offsets[order[i]] != offsets[order[i - 1]])
+			{
+				usize index = _content_create();
+				content[index].offset = offsets[order[i]];
+				content[index].refs = 0;
+			}
+			++content[content.count() - 1].refs;
+			header.files[chunked[order[i]]].index = content.count() - 1;
+		}
+
+		//the chunk sizes are the distances between the sorted chunk offsets
+		//and the data length (which excludes the chunks size prefixes) gives the size of the last one
+		u64 remaining = data_length;
+		for(usize i = first_chunk; i < content.count(); ++i)
+		{
+			auto& chunk = content[i];
+			if(i + 1 < content.count())
+			{
+				u64 chunk_end = content[i + 1].offset;
+				ASSERT_FAIL(ERROR_FILE_CORRUPTED, chunk_end >= chunk.offset + sizeof(u64));
+				chunk.size = chunk_end - chunk.offset - sizeof(u64);
+			}
+			else
 			{
-				ASSERT_FAIL(ERROR_FILE_CORRUPTED, content[i].bin.pipe_in(io, bin_size) == bin_size);
-				content[i].bin.move_to_start();
+				chunk.size = remaining;
 			}
+			ASSERT_FAIL(ERROR_FILE_CORRUPTED, chunk.size <= remaining);
+			remaining -= chunk.size;
 		}
 
+		if(major >= 4)
+			for(usize i = 0; i < chunked.count(); ++i)
+				ASSERT_FAIL(ERROR_FILE_CORRUPTED, content[header.files[chunked[i]].index].size == sizes[i]);
+
 		return ERROR_OK;
 		#undef ASSERT_FAIL
 	}
@@ -488,9 +1863,813 @@ namespace pnsv
 	Pensieve::ERROR_CODE
 	Pensieve::load_from_disk(const char* path)
 	{
-		auto result = File::open(path, IO_MODE::READ, OPEN_MODE::OPEN_ONLY);
-		if(result.error != OS_ERROR::OK)
+		//an already mounted archive keeps its file so this one is streamed instead
+		if(disk.valid() || volumes)
+		{
+			auto result = File::open(path, IO_MODE::READ, OPEN_MODE::OPEN_ONLY);
+			if(result.error != OS_ERROR::OK)
+				return ERROR_FILE_DOESNOT_EXIST;
+			return load_from_stream(result.value);
+		}
+
+		//the header is read in one block and the chunks in a few coalesced reads
+		usize first_file = header.files.count();
+		usize first_content = content.count();
+		ERROR_CODE err = mount_from_disk(path);
+		if(err != ERROR_OK)
+			return err;
+
+		Dynamic_Array<usize> indices;
+		for(usize i = first_content; i < content.count(); ++i)
+			if(content[i].lazy)
+				indices.insert_back(i);
+		bool result = _content_fetch(indices);
+		if(result == false)
+			_load_rollback(first_file, first_content);
+		_disk_release();
+		return result ? ERROR_OK : ERROR_FILE_CORRUPTED;
+	}
+
+	Pensieve::ERROR_CODE
+	Pensieve::load_async(Async_IO& aio, const char* path, Pensieve_Callback callback, void* user_data)
+	{
+		usize first_file = header.files.count();
+		ERROR_CODE err = mount_from_disk(path);
+		if(err != ERROR_OK)
+			return err;
+
+		Dynamic_Array<Virtual_Handle> handles;
+		handles.reserve(header.files.count() - first_file);
+		for(usize i = first_file; i < header.files.count(); ++i)
+			handles.insert_back(Virtual_Handle { i });
+
+		read_async(aio, handles, callback, user_data);
+		return ERROR_OK;
+	}
+
+	Pensieve::ERROR_CODE
+	Pensieve::verify()
+	{
+		Dynamic_Array<usize> indices;
+		for(usize i = 0; i < content.count(); ++i)
+			if(content[i].lazy)
+				indices.insert_back(i);
+		return _content_fetch_parallel(indices, nullptr, true);
+	}
+
+	void
+	Pensieve::load_from_disk_async(Pensieve_Task& task, const char* path)
+	{
+		_operation_start(task, this, path, _load_operation_run);
+	}
+
+	void
+	Pensieve::save_on_disk_async(Pensieve_Task& task, const char* path)
+	{
+		_operation_start(task, this, path, _save_operation_run);
+	}
+
+	void
+	Pensieve::verify_async(Pensieve_Task& task)
+	{
+		_operation_start(task, this, nullptr, _verify_operation_run);
+	}
+
+	Pensieve::ERROR_CODE
+	Pensieve::mount_from_disk(const char* path)
+	{
+		Disk_File file = disk_open(path, IO_MODE::READ);
+		if(file.valid() == false)
 			return ERROR_FILE_DOESNOT_EXIST;
-		return load_from_stream(result.value);
+
+		//the header is read in one block and decoded from memory
+		Memory_Stream block;
+		if(archive_header_read(file, block) == false)
+		{
+			disk_close(file);
+			return ERROR_FILE_CORRUPTED;
+		}
+		ERROR_CODE err = _mount_header(block, disk_size(file));
+		if(err != ERROR_OK)
+		{
+			disk_close(file);
+			return err;
+		}
+
+		disk_close(disk);
+		disk = file;
+		volumes = nullptr;
+		if(cache && archive_id != 0)
+			cache->evict(archive_id);
+		archive_id = archive_id_new();
+		return ERROR_OK;
+	}
+
+	bool
+	Pensieve::save_on_volumes(Volume_Set& set)
+	{
+		if(set.writable == false || &set == volumes)
+			return false;
+
+		//the streamed files can only be read once so they are kept in memory
+		bool result = true;
+		for(usize i = 0; i < content.count(); ++i)
+			if(content[i].source && _content_pipe_source(i) == false)
+				result = false;
+		if(result == false)
+			return false;
+
+		Dynamic_Array<usize> chunks;
+		Dynamic_Array<u64> offsets;
+		Memory_Stream block;
+		_write_header(block, chunks, offsets);
+
+		//the writer gathers the chunks until they cover a stripe on every volume
+		Volume_Writer writer(set);
+		result = _write_chunks(writer, block, chunks);
+		return writer.flush() && result;
+	}
+
+	Pensieve::ERROR_CODE
+	Pensieve::load_from_volumes(Volume_Set& set)
+	{
+		//an already mounted archive gets its file back after the new content is fetched
+		//its id is set aside too so mounting the set doesn't evict its cached blocks
+		Disk_File mounted_disk = disk;
+		Volume_Set* mounted_volumes = volumes;
+		u64 mounted_offset = data_offset;
+		u64 mounted_id = archive_id;
+		disk = INVALID_DISK_FILE;
+		archive_id = 0;
+
+		usize first_file = header.files.count();
+		usize first_content = content.count();
+		ERROR_CODE err = mount_from_volumes(set);
+		if(err == ERROR_OK)
+		{
+			Dynamic_Array<usize> indices;
+			for(usize i = first_content; i < content.count(); ++i)
+				if(content[i].lazy)
+					indices.insert_back(i);
+			//the new entries would be left lazy with offsets into the set, so a failed fetch drops them
+			if(_content_fetch(indices) == false)
+			{
+				_load_rollback(first_file, first_content);
+				err = ERROR_FILE_CORRUPTED;
+			}
+		}
+
+		//nothing reads from the set anymore so its cached blocks go
+		if(cache && archive_id != 0)
+			cache->evict(archive_id);
+		disk = mounted_disk;
+		volumes = mounted_volumes;
+		data_offset = mounted_offset;
+		archive_id = mounted_id;
+		return err;
+	}
+
+	Pensieve::ERROR_CODE
+	Pensieve::mount_from_volumes(Volume_Set& set)
+	{
+		if(set.valid() == false || set.writable)
+			return ERROR_FILE_DOESNOT_EXIST;
+
+		Memory_Stream block;
+		if(archive_header_read(set, block) == false)
+			return ERROR_FILE_CORRUPTED;
+		ERROR_CODE err = _mount_header(block, set.size);
+		if(err != ERROR_OK)
+			return err;
+
+		disk_close(disk);
+		volumes = &set;
+		if(cache && archive_id != 0)
+			cache->evict(archive_id);
+		archive_id = archive_id_new();
+		return ERROR_OK;
+	}
+
+	Pensieve::ERROR_CODE
+	Pensieve::_mount_header(Memory_Stream& block, u64 file_size)
+	{
+		usize first_chunk = 0;
+		u64 data_length = 0, header_size = 0;
+		usize first_file = header.files.count();
+		usize first_content = content.count();
+
+		u16 major = 0, minor = 0;
+		ERROR_CODE err = _load_signature(block, major, minor);
+		if(err == ERROR_OK)
+		{
+			switch(major)
+			{
+				case 1:
+				case 2:
+				case 3:
+				case 4:
+					err = _load_header(block, major, data_length, header_size, first_chunk);
+					break;
+
+				default:
+					err = ERROR_INCOMPATIBLE_MAJOR_VERSION;
+					break;
+			}
+		}
+
+		//every chunk has its size as a prefix
+		if(err == ERROR_OK && file_size < 8 + header_size + data_length + (content.count() - first_chunk) * sizeof(u64))
+			err = ERROR_FILE_CORRUPTED;
+		if(err != ERROR_OK)
+		{
+			_load_rollback(first_file, first_content);
+			return err;
+		}
+
+		//magic + major + minor come before the header
+		data_offset = 8 + header_size;
+
+		for(usize i = first_chunk; i < content.count(); ++i)
+			content[i].lazy = content[i].size > 0;
+
+		return ERROR_OK;
+	}
+
+	usize
+	Pensieve::_data_read(u64 offset, Slice<byte> data) const
+	{
+		if(volumes)
+			return volumes->read(offset, data);
+		return disk_read_at(disk, offset, data);
+	}
+
+	bool
+	Pensieve::_content_fetch(Dynamic_Array<usize>& indices)
+	{
+		Dynamic_Array<Fetch_Span> spans;
+		_coalesce_spans(*this, indices, spans);
+		if(spans.empty())
+			return true;
+
+		if(disk.valid() == false && volumes == nullptr)
+			return false;
+
+		Owner<byte> buffer;
+		bool result = true;
+		for(const auto& span: spans)
+		{
+			usize span_size = usize(span.end - span.start);
+			if(buffer.size < span_size)
+			{
+				if(buffer.ptr)
+					free(buffer);
+				buffer = alloc<byte>(span_size);
+			}
+
+			if(_data_read(data_offset + span.start, make_slice(buffer.ptr, span_size)) != span_size)
+			{
+				result = false;
+				break;
+			}
+
+			if(_split_span(*this, indices, span, buffer.ptr) == false)
+				result = false;
+		}
+
+		if(buffer.ptr)
+			free(buffer);
+		return result;
+	}
+
+	Pensieve::ERROR_CODE
+	Pensieve::_content_fetch_parallel(Dynamic_Array<usize>& indices, const Pensieve_Task* task, bool verify)
+	{
+		Dynamic_Array<Fetch_Span> spans;
+		_coalesce_spans(*this, indices, spans);
+		if(spans.empty())
+			return ERROR_OK;
+
+		if(disk.valid() == false && volumes == nullptr)
+			return ERROR_FILE_CORRUPTED;
+
+		Parallel_Fetch fetch;
+		fetch.pensieve = this;
+		fetch.indices = &indices;
+		fetch.task = task;
+		fetch.verify = verify;
+		fetch.ok.store(true);
+		fetch.cancelled.store(false);
+
+		Dynamic_Array<Parallel_Span> reads;
+		reads.reserve(spans.count());
+		for(const auto& span: spans)
+			reads.insert_back(Parallel_Span{ &fetch, span });
+
+		//every span writes only the content of its own chunks so they don't need a lock
+		Thread_Pool* pool = thread_pool();
+		Task_Group group;
+		for(auto& read: reads)
+		{
+			if(pool)
+				pool->submit(group, _parallel_span_run, &read);
+			else
+				_parallel_span_run(&read);
+		}
+		if(pool)
+			pool->wait(group);
+
+		if(fetch.cancelled.load())
+			return ERROR_CANCELLED;
+		return fetch.ok.load() ? ERROR_OK : ERROR_FILE_CORRUPTED;
+	}
+
+	u64
+	Pensieve::_content_size(usize content_index) const
+	{
+		const auto& c = content[content_index];
+		if(c.lazy || c.source || c.external)
+			return c.size;
+		return c.bin.size();
+	}
+
+	bool
+	Pensieve::_content_pipe_source(usize content_index)
+	{
+		auto& c = content[content_index];
+		IO_Trait* source = c.source;
+		c.source = nullptr;
+		c.bin.clear();
+		bool result = c.bin.pipe_in(source, usize(c.size)) == c.size;
+		c.bin.move_to_start();
+		return result;
+	}
+
+	void
+	Pensieve::_content_copy_external(usize content_index)
+	{
+		auto& c = content[content_index];
+		c.bin.clear();
+		c.bin.write(make_slice(c.external, usize(c.size)));
+		c.bin.move_to_start();
+		_content_drop_external(content_index);
+	}
+
+	void
+	Pensieve::_content_drop_external(usize content_index)
+	{
+		auto& c = content[content_index];
+		if(c.owned.ptr)
+			free(c.owned);
+		c.external = nullptr;
+	}
+
+	usize
+	Pensieve::_content_create()
+	{
+		content.emplace_back();
+		content[content.count() - 1].refs = 1;
+		return content.count() - 1;
+	}
+
+	void
+	Pensieve::_content_release(usize content_index)
+	{
+		auto& c = content[content_index];
+		assert(c.refs > 0);
+		if(--c.refs == 0)
+		{
+			c.bin.reset();
+			c.lazy = false;
+			c.source = nullptr;
+			_content_drop_external(content_index);
+		}
+	}
+
+	usize
+	Pensieve::_file_detach(Virtual_Handle handle, bool keep_data)
+	{
+		usize shared = header.files[handle.header_entry_index].index;
+		if(content[shared].refs <= 1)
+			return shared;
+
+		//copy on write, the file gets its own content and leaves the shared one to the other files
+		usize index = _content_create();
+		--content[shared].refs;
+		if(keep_data)
+		{
+			auto& src = content[shared];
+			auto& dst = content[index];
+			if(src.lazy)
+			{
+				dst.offset = src.offset;
+				dst.size = src.size;
+				dst.lazy = true;
+			}
+			else
+			{
+				vprintb(dst.bin, src.bin.bin_content());
+				dst.bin.move_to_start();
+			}
+		}
+
+		header.files[handle.header_entry_index].index = index;
+		return index;
+	}
+
+	void
+	Pensieve::_dedup_contents(Dynamic_Array<usize>& chunks)
+	{
+		struct Dedup_Item
+		{
+			u64 size;
+			u64 hash;
+			usize index;
+		};
+
+		//hash every live content once
+		Dynamic_Array<usize> remap;
+		remap.reserve(content.count());
+		for(usize i = 0; i < content.count(); ++i)
+			remap.insert_back(usize(-1));
+
+		Dynamic_Array<Dedup_Item> items;
+		for(const auto& file: header.files)
+		{
+			if(file.name.empty() || remap[file.index] != usize(-1))
+				continue;
+
+			//the contents in memory and the external ones are hashed, the ones on disk are already unique chunks
+			remap[file.index] = file.index;
+			if(content[file.index].lazy || content[file.index].source)
+				continue;
+
+			auto data = _content_bytes(file.index);
+			items.insert_back(Dedup_Item{ data.count, hash64(data.ptr, data.count), file.index });
+		}
+
+		if(items.empty() == false)
+		{
+			std::sort(&items[0], &items[0] + items.count(), [](const Dedup_Item& a, const Dedup_Item& b){
+				if(a.size != b.size) return a.size < b.size;
+				if(a.hash != b.hash) return a.hash < b.hash;
+				return a.index < b.index;
+			});
+		}
+
+		//within a run of the same size and hash every item is confirmed against the run's unique contents
+		usize run = 0;
+		for(usize i = 0; i < items.count(); ++i)
+		{
+			if(items[i].size != items[run].size || items[i].hash != items[run].hash)
+				run = i;
+
+			auto data = _content_bytes(items[i].index);
+			for(usize j = run; j < i; ++j)
+			{
+				if(remap[items[j].index] != items[j].index)
+					continue;
+
+				auto other = _content_bytes(items[j].index);
+				if(data.count == 0 || ::memcmp(data.ptr, other.ptr, data.count) == 0)
+				{
+					remap[items[i].index] = items[j].index;
+					break;
+				}
+			}
+		}
+
+		//point the files to the unique contents and release the duplicates
+		for(auto& file: header.files)
+		{
+			if(file.name.empty() || remap[file.index] == file.index)
+				continue;
+
+			usize unique = remap[file.index];
+			_content_release(file.index);
+			++content[unique].refs;
+			file.index = unique;
+		}
+
+		//the removed files and the copies on write leave released contents behind which are dropped here
+		_compact_contents();
+
+		//the chunks are written in the order of the first file which uses them
+		Dynamic_Array<bool> written;
+		written.reserve(content.count());
+		for(usize i = 0; i < content.count(); ++i)
+			written.insert_back(false);
+
+		for(const auto& file: header.files)
+		{
+			if(file.name.empty() || written[file.index])
+				continue;
+			written[file.index] = true;
+			chunks.insert_back(file.index);
+		}
+	}
+
+	void
+	Pensieve::_load_rollback(usize first_file, usize first_content)
+	{
+		header.files.remove_back(header.files.count() - first_file);
+		content.remove_back(content.count() - first_content);
+	}
+
+	void
+	Pensieve::_disk_release()
+	{
+		for(const auto& c: content)
+			if(c.lazy)
+				return;
+		disk_close(disk);
+	}
+
+	void
+	Pensieve::_compact_contents()
+	{
+		Dynamic_Array<usize> remap;
+		remap.reserve(content.count());
+
+		usize live = 0;
+		for(usize i = 0; i < content.count(); ++i)
+		{
+			if(content[i].refs == 0)
+			{
+				remap.insert_back(usize(-1));
+				continue;
+			}
+
+			if(live != i)
+				content[live] = std::move(content[i]);
+			remap.insert_back(live++);
+		}
+
+		if(live == content.count())
+			return;
+
+		content.remove_back(content.count() - live);
+		for(auto& file: header.files)
+			if(file.name.empty() == false)
+				file.index = remap[file.index];
+	}
+
+	void
+	Pensieve::_layout_chunks(Dynamic_Array<usize>& chunks) const
+	{
+		if(chunks.empty())
+			return;
+
+		Dynamic_Array<usize> rank;
+		rank.reserve(content.count());
+		for(usize i = 0; i < content.count(); ++i)
+			rank.insert_back(usize(-1));
+
+		//a shared chunk takes the rank of its first traced file
+		auto handles = _trace_handles(*layout);
+		for(usize i = 0; i < handles.count(); ++i)
+		{
+			usize index = header.files[handles[i].header_entry_index].index;
+			if(rank[index] == usize(-1))
+				rank[index] = i;
+		}
+
+		//the untraced chunks keep their order after the traced ones
+		std::stable_sort(&chunks[0], &chunks[0] + chunks.count(), [&rank](usize a, usize b){
+			return rank[a] < rank[b];
+		});
+	}
+
+	Dynamic_Array<Virtual_Handle>
+	Pensieve::_trace_handles(const Access_Trace& trace) const
+	{
+		struct Name_Item
+		{
+			u64 hash;
+			usize entry;
+		};
+
+		//the header is sorted by the paths hashes once so each trace path is a binary search
+		Dynamic_Array<Name_Item> names;
+		names.reserve(header.files.count());
+		for(usize i = 0; i < header.files.count(); ++i)
+		{
+			const auto& name = header.files[i].name;
+			if(name.empty())
+				continue;
+			names.insert_back(Name_Item{ hash64(name.data(), name.size()), i });
+		}
+
+		Dynamic_Array<Virtual_Handle> result;
+		if(names.empty())
+			return result;
+
+		std::sort(&names[0], &names[0] + names.count(), [](const Name_Item& a, const Name_Item& b){
+			return a.hash < b.hash;
+		});
+
+		for(const auto& path: trace.paths)
+		{
+			u64 hash = hash64(path.data(), path.size());
+			auto it = std::lower_bound(&names[0], &names[0] + names.count(), hash, [](const Name_Item& a, u64 h){
+				return a.hash < h;
+			});
+
+			for(; it != &names[0] + names.count() && it->hash == hash; ++it)
+			{
+				if(header.files[it->entry].name == path)
+				{
+					result.insert_back(Virtual_Handle { it->entry });
+					break;
+				}
+			}
+		}
+		return result;
+	}
+
+	void
+	Access_Trace::record(const String& path)
+	{
+		if(_seen_insert(path, hash64(path.data(), path.size())))
+			paths.insert_back(path);
+	}
+
+	void
+	Access_Trace::clear()
+	{
+		paths.clear();
+		_seen.clear();
+	}
+
+	bool
+	Access_Trace::save_to_disk(const char* path) const
+	{
+		auto file = File::open(path);
+		if(file.error != OS_ERROR::OK)
+			return false;
+
+		u32 paths_count = u32(paths.count());
+		bool result = vprintb(file.value, paths_count) == sizeof(paths_count);
+		for(const auto& p: paths)
+		{
+			u16 path_size = u16(p.size());
+			result &= vprintb(file.value, path_size, p) == sizeof(path_size) + path_size;
+		}
+		return result;
+	}
+
+	bool
+	Access_Trace::load_from_disk(const char* path)
+	{
+		auto file = File::open(path, IO_MODE::READ, OPEN_MODE::OPEN_ONLY);
+		if(file.error != OS_ERROR::OK)
+			return false;
+
+		clear();
+		u32 paths_count = 0;
+		if(vreadb(file.value, paths_count) != sizeof(paths_count))
+			return false;
+
+		for(u32 i = 0; i < paths_count; ++i)
+		{
+			u16 path_size = 0;
+			if(vreadb(file.value, path_size) != sizeof(path_size))
+				return false;
+
+			auto path_data = alloc<byte>(path_size);
+			if(vreadb(file.value, path_data.all()) != path_size)
+			{
+				free(path_data);
+				return false;
+			}
+			record(String(std::move(path_data)));
+		}
+		return true;
+	}
+
+	bool
+	Access_Trace::_seen_insert(const String& path, u64 hash)
+	{
+		if((paths.count() + 1) * 2 > _seen.count())
+		{
+			usize capacity = _seen.empty() ? 64 : _seen.count() * 2;
+			Dynamic_Array<Seen_Slot> old(std::move(_seen));
+			_seen = Dynamic_Array<Seen_Slot>();
+			_seen.reserve(capacity);
+			for(usize i = 0; i < capacity; ++i)
+				_seen.insert_back(Seen_Slot { 0, usize(-1) });
+
+			for(const auto& slot: old)
+			{
+				if(slot.path == usize(-1))
+					continue;
+				usize i = usize(slot.hash) & (capacity - 1);
+				while(_seen[i].path != usize(-1))
+					i = (i + 1) & (capacity - 1);
+				_seen[i] = slot;
+			}
+		}
+
+		//the paths which collide on the hash are told apart by their names
+		usize mask = _seen.count() - 1;
+		for(usize i = usize(hash) & mask; ; i = (i + 1) & mask)
+		{
+			auto& slot = _seen[i];
+			if(slot.path == usize(-1))
+			{
+				slot = Seen_Slot { hash, paths.count() };
+				return true;
+			}
+			if(slot.hash == hash && paths[slot.path] == path)
+				return false;
+		}
+	}
+
+	bool
+	Pensieve::_file_fetch(usize content_index)
+	{
+		Dynamic_Array<usize> indices;
+		indices.insert_back(content_index);
+		return _content_fetch(indices);
+	}
+
+	bool
+	Pensieve::_fetch_all()
+	{
+		Dynamic_Array<usize> indices;
+		for(usize i = 0; i < content.count(); ++i)
+			if(content[i].lazy)
+				indices.insert_back(i);
+		bool result = _content_fetch(indices);
+
+		for(usize i = 0; i < content.count(); ++i)
+			if(content[i].source && _content_pipe_source(i) == false)
+				result = false;
+		return result;
+	}
+
+	Pensieve_Task::Pensieve_Task(Pensieve_Callback callback, void* user_data)
+		:pensieve(nullptr),
+		 error(Pensieve::ERROR_OK),
+		 pool(nullptr),
+		 cancelled(false),
+		 done(true),
+		 callback(callback),
+		 user_data(user_data)
+	{}
+
+	void
+	Pensieve_Task::cancel()
+	{
+		cancelled.store(true);
+	}
+
+	Pensieve::ERROR_CODE
+	Pensieve_Task::wait()
+	{
+		//the waiting thread keeps helping with the queued tasks instead of blocking a worker
+		//and sleeps on the pool until the operation queues more of them or is done
+		Task task{};
+		while(done.load() == false)
+		{
+			if(pool == nullptr)
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				finished.wait(lock, [this]{
+					return done.load();
+				});
+				continue;
+			}
+
+			if(pool->_task_take(usize(-1), task))
+				pool->_task_run(task);
+			else
+				pool->wait_for_work(done);
+		}
+
+		//waits for _finish to release the lock so the task isn't freed under it
+		std::lock_guard<std::mutex> lock(mutex);
+		return error;
+	}
+
+	bool
+	Pensieve_Task::is_done() const
+	{
+		return done.load();
+	}
+
+	void
+	Pensieve_Task::_finish(Pensieve::ERROR_CODE err)
+	{
+		error = err;
+		if(callback)
+			callback(pensieve, err == Pensieve::ERROR_OK, user_data);
+
+		//notified under the lock so a waiter can't free the task before notify_all returns
+		std::lock_guard<std::mutex> lock(mutex);
+		done.store(true);
+		finished.notify_all();
+		//the waiter could be sleeping on the pool instead
+		if(pool)
+			pool->wake();
 	}
 }
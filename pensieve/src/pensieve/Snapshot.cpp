@@ -0,0 +1,221 @@
+#include "pensieve/Snapshot.h"
+
+#include <algorithm>
+#include <new>
+#include <string.h>
+
+namespace pnsv
+{
+	//the snapshots and blobs are freed by their last reference so they're allocated one by one
+	template<typename T>
+	static T*
+	_shared_new()
+	{
+		return ::new(alloc<T>().ptr) T{};
+	}
+
+	template<typename T>
+	static void
+	_shared_free(T* shared)
+	{
+		shared->~T();
+		free(Owner<T>(shared, 1));
+	}
+
+	static void
+	_blob_release(Snapshot_Blob* blob)
+	{
+		if(--blob->refs > 0)
+			return;
+		free(blob->data);
+		_shared_free(blob);
+	}
+
+	static void
+	_snapshot_free(Snapshot* snapshot)
+	{
+		for(Snapshot_Blob* blob: snapshot->blobs)
+			_blob_release(blob);
+		_shared_free(snapshot);
+	}
+
+	//adds a file which borrows the blob content, it doesn't search for an existing path like file_create
+	static void
+	_snapshot_add(Pensieve& archive, const File_Header_Entry& entry, const Snapshot_Blob* blob)
+	{
+		usize index = archive._content_create();
+		archive.header.files.insert_back(File_Header_Entry{
+			entry.name,
+			index,
+			entry.flags,
+			entry.mtime,
+			entry.tags
+		});
+
+		auto& c = archive.content[index];
+		c.external = blob->data.ptr;
+		c.size = blob->data.size;
+	}
+
+	Virtual_Handle
+	Snapshot::file_open(const String& path) const
+	{
+		assert(valid_path(path.all()));
+		auto handle = archive.header.file_exists(path);
+		if(handle.valid() && archive.file_is_whiteout(handle))
+			return INVALID_FILE_HANDLE;
+		return handle;
+	}
+
+	Snapshot_Store::Snapshot_Store()
+		:_acquiring(0)
+	{
+		Snapshot* snapshot = _shared_new<Snapshot>();
+		snapshot->refs = 1;
+		snapshot->version = 0;
+		_current = snapshot;
+	}
+
+	Snapshot_Store::~Snapshot_Store()
+	{
+		_collect();
+		Snapshot* snapshot = _current.load();
+		assert(snapshot->refs == 1 && _retired.empty());
+		_snapshot_free(snapshot);
+	}
+
+	Snapshot_Ref
+	Snapshot_Store::acquire() const
+	{
+		//the writer doesn't free any replaced snapshot while a reader is between the load and the increment
+		_acquiring.fetch_add(1);
+		Snapshot* snapshot = _current.load();
+		snapshot->refs.fetch_add(1);
+		_acquiring.fetch_sub(1);
+		return Snapshot_Ref(snapshot);
+	}
+
+	Snapshot_Draft
+	Snapshot_Store::draft() const
+	{
+		Snapshot_Draft result;
+		result.base = acquire();
+
+		const Snapshot& base = *result.base;
+		const auto& files = base.archive.header.files;
+		result.archive.header.files.reserve(files.count());
+		for(usize i = 0; i < files.count(); ++i)
+			_snapshot_add(result.archive, files[i], base.blobs[i]);
+		return result;
+	}
+
+	bool
+	Snapshot_Store::publish(Snapshot_Draft& draft)
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+
+		Snapshot* base = _current.load();
+		if(draft.base.snapshot != base)
+			return false;
+
+		auto& archive = draft.archive;
+		if(archive._fetch_all() == false)
+			return false;
+
+		//the unchanged files still borrow the memory of the base blobs
+		Dynamic_Array<Snapshot_Blob*> base_blobs;
+		base_blobs.reserve(base->blobs.count());
+		for(Snapshot_Blob* blob: base->blobs)
+			base_blobs.insert_back(blob);
+		if(base_blobs.empty() == false)
+			std::sort(&base_blobs[0], &base_blobs[0] + base_blobs.count(), [](const Snapshot_Blob* a, const Snapshot_Blob* b){
+				return a->data.ptr < b->data.ptr;
+			});
+
+		Snapshot* snapshot = _shared_new<Snapshot>();
+		snapshot->refs = 1;
+		snapshot->version = base->version + 1;
+		snapshot->archive.header.files.reserve(archive.header.files.count());
+		snapshot->blobs.reserve(archive.header.files.count());
+
+		for(usize i = 0; i < archive.header.files.count(); ++i)
+		{
+			const auto& entry = archive.header.files[i];
+			//deleted entries have no name
+			if(entry.name.empty())
+				continue;
+
+			auto& c = archive.content[entry.index];
+			auto bytes = archive._content_bytes(entry.index);
+
+			Snapshot_Blob* blob = nullptr;
+			if(c.external && c.owned.ptr == nullptr && base_blobs.empty() == false)
+			{
+				auto it = std::lower_bound(&base_blobs[0], &base_blobs[0] + base_blobs.count(), bytes.ptr, [](const Snapshot_Blob* b, const byte* ptr){
+					return b->data.ptr < ptr;
+				});
+				if(it != &base_blobs[0] + base_blobs.count() && (*it)->data.ptr == bytes.ptr && (*it)->data.size == bytes.count)
+				{
+					blob = *it;
+					++blob->refs;
+				}
+			}
+
+			if(blob == nullptr)
+			{
+				blob = _shared_new<Snapshot_Blob>();
+				blob->refs = 1;
+				if(c.owned.ptr && c.owned.ptr == bytes.ptr && c.owned.size == bytes.count)
+				{
+					//the adopted memory moves into the blob without a copy
+					blob->data = std::move(c.owned);
+					c.owned = Owner<byte>();
+				}
+				else
+				{
+					blob->data = alloc<byte>(bytes.count);
+					if(bytes.count > 0)
+						::memcpy(blob->data.ptr, bytes.ptr, bytes.count);
+				}
+			}
+
+			_snapshot_add(snapshot->archive, entry, blob);
+			snapshot->blobs.insert_back(blob);
+		}
+
+		//the draft is consumed and its base is released before the old snapshot is retired
+		archive = Pensieve();
+		draft.base.release();
+
+		Snapshot* old = _current.exchange(snapshot);
+		old->refs.fetch_sub(1);
+		_retired.insert_back(old);
+		_collect();
+		return true;
+	}
+
+	void
+	Snapshot_Store::collect()
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_collect();
+	}
+
+	void
+	Snapshot_Store::_collect()
+	{
+		//a reader in the middle of acquire could have loaded a replaced snapshot without referencing it yet
+		if(_acquiring.load() != 0)
+			return;
+
+		usize kept = 0;
+		for(usize i = 0; i < _retired.count(); ++i)
+		{
+			if(_retired[i]->refs.load() == 0)
+				_snapshot_free(_retired[i]);
+			else
+				_retired[kept++] = _retired[i];
+		}
+		_retired.remove_back(_retired.count() - kept);
+	}
+}
@@ -0,0 +1,615 @@
+#include "pensieve/Table.h"
+
+#include <string.h>
+#include <type_traits>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#define PNSV_SSE2 1
+	#include <emmintrin.h>
+#endif
+
+namespace pnsv
+{
+	static u64
+	_align_up(u64 value, u64 alignment)
+	{
+		return (value + alignment - 1) / alignment * alignment;
+	}
+
+	usize
+	column_type_size(COLUMN_TYPE type)
+	{
+		switch(type)
+		{
+			case COLUMN_TYPE::I32:
+			case COLUMN_TYPE::U32:
+			case COLUMN_TYPE::F32:
+				return 4;
+
+			case COLUMN_TYPE::I64:
+			case COLUMN_TYPE::U64:
+			case COLUMN_TYPE::F64:
+				return 8;
+
+			default:
+				return 0;
+		}
+	}
+
+	Table::Table()
+		:archive(nullptr),
+		 handle(INVALID_FILE_HANDLE),
+		 rows_count(0)
+	{}
+
+	Table::~Table()
+	{
+		close();
+	}
+
+	bool
+	Table::open(Pensieve& pn, Virtual_Handle file)
+	{
+		#define ASSERT_FAIL(...) if((__VA_ARGS__) == false) { close(); return false; }
+
+		close();
+		if(file_is_table(pn, file) == false)
+			return false;
+
+		archive = &pn;
+		handle = file;
+		u64 file_size = pn.file_size(file);
+
+		u32 magic = 0, columns_count = 0;
+		byte prefix[16];
+		ASSERT_FAIL(pn.file_read(file, 0, make_slice(prefix, sizeof(prefix))) == sizeof(prefix));
+		::memcpy(&magic, prefix, 4);
+		::memcpy(&columns_count, prefix + 4, 4);
+		::memcpy(&rows_count, prefix + 8, 8);
+		ASSERT_FAIL(magic == TABLE_MAGIC);
+		ASSERT_FAIL(rows_count <= MAX_ROWS_COUNT);
+
+		//the schema is read in one go, every column takes at most 265 bytes of it
+		u64 schema_size = u64(columns_count) * (2 + 255 + 8);
+		if(schema_size > file_size - sizeof(prefix))
+			schema_size = file_size - sizeof(prefix);
+		//every column takes at least 10 bytes so a larger count can't fit in the schema
+		ASSERT_FAIL(columns_count <= schema_size / 10);
+
+		auto schema = alloc<byte>(usize(schema_size));
+		bool ok = pn.file_read(file, sizeof(prefix), make_slice(schema.ptr, usize(schema_size))) == schema_size;
+
+		usize cursor = 0;
+		columns.reserve(columns_count);
+		for(u32 i = 0; ok && i < columns_count; ++i)
+		{
+			if(cursor + 2 > schema_size)
+			{
+				ok = false;
+				break;
+			}
+			COLUMN_TYPE type = COLUMN_TYPE(schema.ptr[cursor]);
+			usize name_size = schema.ptr[cursor + 1];
+			cursor += 2;
+			if(cursor + name_size + 8 > schema_size)
+			{
+				ok = false;
+				break;
+			}
+
+			auto name_data = alloc<byte>(name_size);
+			::memcpy(name_data.ptr, schema.ptr + cursor, name_size);
+			cursor += name_size;
+
+			u64 offset = 0;
+			::memcpy(&offset, schema.ptr + cursor, 8);
+			cursor += 8;
+
+			usize value_size = column_type_size(type);
+			ok = value_size > 0 && offset % COLUMN_ALIGNMENT == 0 && offset <= file_size &&
+				 rows_count <= (file_size - offset) / value_size;
+
+			columns.insert_back(Table_Column{ String(std::move(name_data)), type, offset });
+			_loaded.emplace_back();
+		}
+		free(schema);
+		ASSERT_FAIL(ok);
+		return true;
+
+		#undef ASSERT_FAIL
+	}
+
+	void
+	Table::close()
+	{
+		for(auto& loaded: _loaded)
+			if(loaded.ptr)
+				free(loaded);
+		_loaded.clear();
+		columns.clear();
+		archive = nullptr;
+		handle = INVALID_FILE_HANDLE;
+		rows_count = 0;
+	}
+
+	usize
+	Table::column_find(const String& name) const
+	{
+		for(usize i = 0; i < columns.count(); ++i)
+			if(columns[i].name == name)
+				return i;
+		return usize(-1);
+	}
+
+	File_View<byte>
+	Table::_column_bytes(usize index)
+	{
+		assert(columns.count() > index);
+		const auto& column = columns[index];
+		usize size = usize(rows_count * column_type_size(column.type));
+
+		const Pensieve& pn = *archive;
+		const auto& c = pn.content[pn.header.files[handle.header_entry_index].index];
+		if(c.lazy == false)
+		{
+			auto bytes = pn._file_bytes(handle);
+			if(column.offset + size > bytes.count)
+				return File_View<byte>{ nullptr, 0, true };
+			return File_View<byte>{ bytes.ptr + column.offset, size };
+		}
+
+		//only this column is read from the mounted archive
+		auto& loaded = _loaded[index];
+		if(loaded.ptr == nullptr)
+		{
+			loaded = alloc<byte>(size);
+			if(pn.file_read(handle, column.offset, make_slice(loaded.ptr, size)) != size)
+			{
+				free(loaded);
+				return File_View<byte>{ nullptr, 0, true };
+			}
+		}
+		return File_View<byte>{ loaded.ptr, size };
+	}
+
+	Virtual_Handle
+	table_create(Pensieve& archive, const String& path, const Dynamic_Array<Table_Column_Data>& columns, u64 rows_count)
+	{
+		if(rows_count > Table::MAX_ROWS_COUNT)
+			return INVALID_FILE_HANDLE;
+
+		u64 schema_size = 16;
+		for(const auto& column: columns)
+		{
+			if(column.name.empty() || column.name.size() > 255 || column_type_size(column.type) == 0)
+				return INVALID_FILE_HANDLE;
+			if(rows_count > 0 && column.data == nullptr)
+				return INVALID_FILE_HANDLE;
+			schema_size += 2 + column.name.size() + 8;
+		}
+
+		Dynamic_Array<u64> offsets;
+		offsets.reserve(columns.count());
+		u64 total_size = schema_size;
+		for(const auto& column: columns)
+		{
+			u64 offset = _align_up(total_size, Table::COLUMN_ALIGNMENT);
+			offsets.insert_back(offset);
+			total_size = offset + rows_count * column_type_size(column.type);
+		}
+
+		auto handle = archive.file_create(path);
+		if(handle.valid() == false)
+			return handle;
+		archive.header.files[handle.header_entry_index].flags |= ENTRY_FLAG_TABLE;
+
+		//the reserved bytes are zeros so the padding is already written
+		auto out = archive.file_append_reserve(handle, usize(total_size));
+		u32 magic = Table::TABLE_MAGIC;
+		u32 columns_count = u32(columns.count());
+		::memcpy(out.ptr, &magic, 4);
+		::memcpy(out.ptr + 4, &columns_count, 4);
+		::memcpy(out.ptr + 8, &rows_count, 8);
+
+		usize cursor = 16;
+		for(usize i = 0; i < columns.count(); ++i)
+		{
+			const auto& column = columns[i];
+			out.ptr[cursor] = byte(column.type);
+			out.ptr[cursor + 1] = byte(column.name.size());
+			cursor += 2;
+			::memcpy(out.ptr + cursor, column.name.data(), column.name.size());
+			cursor += column.name.size();
+			::memcpy(out.ptr + cursor, &offsets[i], 8);
+			cursor += 8;
+
+			usize size = usize(rows_count * column_type_size(column.type));
+			if(size > 0)
+				::memcpy(out.ptr + offsets[i], column.data, size);
+		}
+		return handle;
+	}
+
+	bool
+	file_is_table(const Pensieve& archive, Virtual_Handle handle)
+	{
+		assert(archive.header.files.count() > handle.header_entry_index);
+		return archive.header.files[handle.header_entry_index].flags & ENTRY_FLAG_TABLE;
+	}
+
+
+	//scan kernels
+
+	template<SCAN_OP OP, typename T>
+	inline static bool
+	_pass(T a, T b)
+	{
+		switch(OP)
+		{
+			case SCAN_OP::LESS: return a < b;
+			case SCAN_OP::LESS_EQUAL: return a <= b;
+			case SCAN_OP::EQUAL: return a == b;
+			case SCAN_OP::NOT_EQUAL: return a != b;
+			case SCAN_OP::GREATER_EQUAL: return a >= b;
+			case SCAN_OP::GREATER: return a > b;
+			default: return false;
+		}
+	}
+
+	//calls f with the op as a compile time constant so the kernels have no branch on it
+	template<typename TFunc>
+	inline static void
+	_op_dispatch(SCAN_OP op, TFunc&& f)
+	{
+		switch(op)
+		{
+			case SCAN_OP::LESS: f(std::integral_constant<SCAN_OP, SCAN_OP::LESS>{}); break;
+			case SCAN_OP::LESS_EQUAL: f(std::integral_constant<SCAN_OP, SCAN_OP::LESS_EQUAL>{}); break;
+			case SCAN_OP::EQUAL: f(std::integral_constant<SCAN_OP, SCAN_OP::EQUAL>{}); break;
+			case SCAN_OP::NOT_EQUAL: f(std::integral_constant<SCAN_OP, SCAN_OP::NOT_EQUAL>{}); break;
+			case SCAN_OP::GREATER_EQUAL: f(std::integral_constant<SCAN_OP, SCAN_OP::GREATER_EQUAL>{}); break;
+			case SCAN_OP::GREATER: f(std::integral_constant<SCAN_OP, SCAN_OP::GREATER>{}); break;
+			default: break;
+		}
+	}
+
+	template<SCAN_OP OP, typename T>
+	static void
+	_filter_scalar(const T* values, usize start, usize count, T value, Dynamic_Array<u32>& rows)
+	{
+		for(usize i = start; i < count; ++i)
+			if(_pass<OP>(values[i], value))
+				rows.insert_back(u32(i));
+	}
+
+	template<SCAN_OP OP, typename T>
+	static void
+	_refine(const T* values, T value, Dynamic_Array<u32>& rows)
+	{
+		usize kept = 0;
+		for(usize i = 0; i < rows.count(); ++i)
+		{
+			u32 row = rows[i];
+			rows[kept] = row;
+			kept += _pass<OP>(values[row], value);
+		}
+		rows.remove_back(rows.count() - kept);
+	}
+
+	inline static void
+	_mask_rows(int mask, usize lanes, usize base, Dynamic_Array<u32>& rows)
+	{
+		for(usize lane = 0; mask != 0 && lane < lanes; ++lane)
+			if(mask & (1 << lane))
+				rows.insert_back(u32(base + lane));
+	}
+
+	#if defined(PNSV_SSE2)
+
+	//compares 4 i32 lanes, u32 lanes are compared by flipping their sign bits first
+	template<SCAN_OP OP>
+	inline static int
+	_mask_epi32(__m128i a, __m128i b)
+	{
+		switch(OP)
+		{
+			case SCAN_OP::LESS: return _mm_movemask_ps(_mm_castsi128_ps(_mm_cmplt_epi32(a, b)));
+			case SCAN_OP::LESS_EQUAL: return _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(a, b))) ^ 0xF;
+			case SCAN_OP::EQUAL: return _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(a, b)));
+			case SCAN_OP::NOT_EQUAL: return _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(a, b))) ^ 0xF;
+			case SCAN_OP::GREATER_EQUAL: return _mm_movemask_ps(_mm_castsi128_ps(_mm_cmplt_epi32(a, b))) ^ 0xF;
+			case SCAN_OP::GREATER: return _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(a, b)));
+			default: return 0;
+		}
+	}
+
+	template<SCAN_OP OP>
+	inline static int
+	_mask_ps(__m128 a, __m128 b)
+	{
+		switch(OP)
+		{
+			case SCAN_OP::LESS: return _mm_movemask_ps(_mm_cmplt_ps(a, b));
+			case SCAN_OP::LESS_EQUAL: return _mm_movemask_ps(_mm_cmple_ps(a, b));
+			case SCAN_OP::EQUAL: return _mm_movemask_ps(_mm_cmpeq_ps(a, b));
+			case SCAN_OP::NOT_EQUAL: return _mm_movemask_ps(_mm_cmpneq_ps(a, b));
+			case SCAN_OP::GREATER_EQUAL: return _mm_movemask_ps(_mm_cmpge_ps(a, b));
+			case SCAN_OP::GREATER: return _mm_movemask_ps(_mm_cmpgt_ps(a, b));
+			default: return 0;
+		}
+	}
+
+	template<SCAN_OP OP>
+	inline static int
+	_mask_pd(__m128d a, __m128d b)
+	{
+		switch(OP)
+		{
+			case SCAN_OP::LESS: return _mm_movemask_pd(_mm_cmplt_pd(a, b));
+			case SCAN_OP::LESS_EQUAL: return _mm_movemask_pd(_mm_cmple_pd(a, b));
+			case SCAN_OP::EQUAL: return _mm_movemask_pd(_mm_cmpeq_pd(a, b));
+			case SCAN_OP::NOT_EQUAL: return _mm_movemask_pd(_mm_cmpneq_pd(a, b));
+			case SCAN_OP::GREATER_EQUAL: return _mm_movemask_pd(_mm_cmpge_pd(a, b));
+			case SCAN_OP::GREATER: return _mm_movemask_pd(_mm_cmpgt_pd(a, b));
+			default: return 0;
+		}
+	}
+
+	template<SCAN_OP OP>
+	static void
+	_filter_epi32(const void* values, usize count, __m128i value, __m128i flip, Dynamic_Array<u32>& rows)
+	{
+		const byte* ptr = static_cast<const byte*>(values);
+		for(usize i = 0; i + 4 <= count; i += 4)
+		{
+			__m128i a = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr + i * 4)), flip);
+			_mask_rows(_mask_epi32<OP>(a, value), 4, i, rows);
+		}
+	}
+
+	#endif
+
+	void
+	column_filter(File_View<i32> column, SCAN_OP op, i32 value, Dynamic_Array<u32>& rows)
+	{
+		_op_dispatch(op, [&](auto OP) {
+			usize start = 0;
+			#if defined(PNSV_SSE2)
+			_filter_epi32<decltype(OP)::value>(column.ptr, column.count, _mm_set1_epi32(value), _mm_setzero_si128(), rows);
+			start = column.count / 4 * 4;
+			#endif
+			_filter_scalar<decltype(OP)::value>(column.ptr, start, column.count, value, rows);
+		});
+	}
+
+	void
+	column_filter(File_View<u32> column, SCAN_OP op, u32 value, Dynamic_Array<u32>& rows)
+	{
+		_op_dispatch(op, [&](auto OP) {
+			usize start = 0;
+			#if defined(PNSV_SSE2)
+			__m128i flip = _mm_set1_epi32(i32(0x80000000));
+			_filter_epi32<decltype(OP)::value>(column.ptr, column.count, _mm_xor_si128(_mm_set1_epi32(i32(value)), flip), flip, rows);
+			start = column.count / 4 * 4;
+			#endif
+			_filter_scalar<decltype(OP)::value>(column.ptr, start, column.count, value, rows);
+		});
+	}
+
+	void
+	column_filter(File_View<i64> column, SCAN_OP op, i64 value, Dynamic_Array<u32>& rows)
+	{
+		//SSE2 has no 64-bit integer compares
+		_op_dispatch(op, [&](auto OP) {
+			_filter_scalar<decltype(OP)::value>(column.ptr, 0, column.count, value, rows);
+		});
+	}
+
+	void
+	column_filter(File_View<u64> column, SCAN_OP op, u64 value, Dynamic_Array<u32>& rows)
+	{
+		_op_dispatch(op, [&](auto OP) {
+			_filter_scalar<decltype(OP)::value>(column.ptr, 0, column.count, value, rows);
+		});
+	}
+
+	void
+	column_filter(File_View<r32> column, SCAN_OP op, r32 value, Dynamic_Array<u32>& rows)
+	{
+		_op_dispatch(op, [&](auto OP) {
+			usize start = 0;
+			#if defined(PNSV_SSE2)
+			__m128 b = _mm_set1_ps(value);
+			for(; start + 4 <= column.count; start += 4)
+				_mask_rows(_mask_ps<decltype(OP)::value>(_mm_loadu_ps(column.ptr + start), b), 4, start, rows);
+			#endif
+			_filter_scalar<decltype(OP)::value>(column.ptr, start, column.count, value, rows);
+		});
+	}
+
+	void
+	column_filter(File_View<r64> column, SCAN_OP op, r64 value, Dynamic_Array<u32>& rows)
+	{
+		_op_dispatch(op, [&](auto OP) {
+			usize start = 0;
+			#if defined(PNSV_SSE2)
+			__m128d b = _mm_set1_pd(value);
+			for(; start + 2 <= column.count; start += 2)
+				_mask_rows(_mask_pd<decltype(OP)::value>(_mm_loadu_pd(column.ptr + start), b), 2, start, rows);
+			#endif
+			_filter_scalar<decltype(OP)::value>(column.ptr, start, column.count, value, rows);
+		});
+	}
+
+	void
+	column_refine(File_View<i32> column, SCAN_OP op, i32 value, Dynamic_Array<u32>& rows)
+	{
+		_op_dispatch(op, [&](auto OP) { _refine<decltype(OP)::value>(column.ptr, value, rows); });
+	}
+
+	void
+	column_refine(File_View<u32> column, SCAN_OP op, u32 value, Dynamic_Array<u32>& rows)
+	{
+		_op_dispatch(op, [&](auto OP) { _refine<decltype(OP)::value>(column.ptr, value, rows); });
+	}
+
+	void
+	column_refine(File_View<i64> column, SCAN_OP op, i64 value, Dynamic_Array<u32>& rows)
+	{
+		_op_dispatch(op, [&](auto OP) { _refine<decltype(OP)::value>(column.ptr, value, rows); });
+	}
+
+	void
+	column_refine(File_View<u64> column, SCAN_OP op, u64 value, Dynamic_Array<u32>& rows)
+	{
+		_op_dispatch(op, [&](auto OP) { _refine<decltype(OP)::value>(column.ptr, value, rows); });
+	}
+
+	void
+	column_refine(File_View<r32> column, SCAN_OP op, r32 value, Dynamic_Array<u32>& rows)
+	{
+		_op_dispatch(op, [&](auto OP) { _refine<decltype(OP)::value>(column.ptr, value, rows); });
+	}
+
+	void
+	column_refine(File_View<r64> column, SCAN_OP op, r64 value, Dynamic_Array<u32>& rows)
+	{
+		_op_dispatch(op, [&](auto OP) { _refine<decltype(OP)::value>(column.ptr, value, rows); });
+	}
+
+	//four independent accumulators so the adds don't wait on each other and the compiler can vectorize them
+	template<typename TSum, typename T>
+	static TSum
+	_sum(const T* values, usize count)
+	{
+		TSum s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+		usize i = 0;
+		for(; i + 4 <= count; i += 4)
+		{
+			s0 += TSum(values[i]);
+			s1 += TSum(values[i + 1]);
+			s2 += TSum(values[i + 2]);
+			s3 += TSum(values[i + 3]);
+		}
+		for(; i < count; ++i)
+			s0 += TSum(values[i]);
+		return (s0 + s1) + (s2 + s3);
+	}
+
+	template<typename TSum, typename T>
+	static TSum
+	_sum_rows(const T* values, const Dynamic_Array<u32>& rows)
+	{
+		TSum result = 0;
+		for(u32 row: rows)
+			result += TSum(values[row]);
+		return result;
+	}
+
+	i64
+	column_sum(File_View<i32> column)
+	{
+		return _sum<i64>(column.ptr, column.count);
+	}
+
+	u64
+	column_sum(File_View<u32> column)
+	{
+		return _sum<u64>(column.ptr, column.count);
+	}
+
+	i64
+	column_sum(File_View<i64> column)
+	{
+		//summed as unsigned so an overflow wraps instead of being undefined
+		return i64(_sum<u64>(reinterpret_cast<const u64*>(column.ptr), column.count));
+	}
+
+	u64
+	column_sum(File_View<u64> column)
+	{
+		return _sum<u64>(column.ptr, column.count);
+	}
+
+	r64
+	column_sum(File_View<r32> column)
+	{
+		#if defined(PNSV_SSE2)
+		//the floats are widened to r64 before adding so long columns don't lose precision
+		__m128d s0 = _mm_setzero_pd(), s1 = _mm_setzero_pd();
+		usize i = 0;
+		for(; i + 4 <= column.count; i += 4)
+		{
+			__m128 v = _mm_loadu_ps(column.ptr + i);
+			s0 = _mm_add_pd(s0, _mm_cvtps_pd(v));
+			s1 = _mm_add_pd(s1, _mm_cvtps_pd(_mm_movehl_ps(v, v)));
+		}
+		r64 lanes[2];
+		_mm_storeu_pd(lanes, _mm_add_pd(s0, s1));
+		r64 result = lanes[0] + lanes[1];
+		for(; i < column.count; ++i)
+			result += r64(column.ptr[i]);
+		return result;
+		#else
+		return _sum<r64>(column.ptr, column.count);
+		#endif
+	}
+
+	r64
+	column_sum(File_View<r64> column)
+	{
+		#if defined(PNSV_SSE2)
+		__m128d s0 = _mm_setzero_pd(), s1 = _mm_setzero_pd();
+		usize i = 0;
+		for(; i + 4 <= column.count; i += 4)
+		{
+			s0 = _mm_add_pd(s0, _mm_loadu_pd(column.ptr + i));
+			s1 = _mm_add_pd(s1, _mm_loadu_pd(column.ptr + i + 2));
+		}
+		r64 lanes[2];
+		_mm_storeu_pd(lanes, _mm_add_pd(s0, s1));
+		r64 result = lanes[0] + lanes[1];
+		for(; i < column.count; ++i)
+			result += column.ptr[i];
+		return result;
+		#else
+		return _sum<r64>(column.ptr, column.count);
+		#endif
+	}
+
+	i64
+	column_sum(File_View<i32> column, const Dynamic_Array<u32>& rows)
+	{
+		return _sum_rows<i64>(column.ptr, rows);
+	}
+
+	u64
+	column_sum(File_View<u32> column, const Dynamic_Array<u32>& rows)
+	{
+		return _sum_rows<u64>(column.ptr, rows);
+	}
+
+	i64
+	column_sum(File_View<i64> column, const Dynamic_Array<u32>& rows)
+	{
+		return i64(_sum_rows<u64>(reinterpret_cast<const u64*>(column.ptr), rows));
+	}
+
+	u64
+	column_sum(File_View<u64> column, const Dynamic_Array<u32>& rows)
+	{
+		return _sum_rows<u64>(column.ptr, rows);
+	}
+
+	r64
+	column_sum(File_View<r32> column, const Dynamic_Array<u32>& rows)
+	{
+		return _sum_rows<r64>(column.ptr, rows);
+	}
+
+	r64
+	column_sum(File_View<r64> column, const Dynamic_Array<u32>& rows)
+	{
+		return _sum_rows<r64>(column.ptr, rows);
+	}
+}
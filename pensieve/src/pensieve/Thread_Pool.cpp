@@ -0,0 +1,259 @@
+#include "pensieve/Thread_Pool.h"
+
+#if defined(OS_WINDOWS)
+	#define WIN32_LEAN_AND_MEAN
+	#include <Windows.h>
+#elif defined(OS_LINUX)
+	#include <pthread.h>
+	#include <sched.h>
+#endif
+
+#include <new>
+
+namespace pnsv
+{
+	struct Task_Worker
+	{
+		std::mutex mutex;
+		//ring of the queued tasks, the owner takes from the back and the thieves from the front
+		Dynamic_Array<Task> ring;
+		usize head;
+		usize count;
+	};
+
+	static std::atomic<Thread_Pool*> _global_pool(nullptr);
+	static thread_local Thread_Pool* _worker_pool = nullptr;
+	static thread_local usize _worker_index = usize(-1);
+
+	static void
+	_queue_push(Task_Worker& worker, const Task& task)
+	{
+		std::lock_guard<std::mutex> lock(worker.mutex);
+		usize capacity = worker.ring.count();
+		if(worker.count == capacity)
+		{
+			Dynamic_Array<Task> ring;
+			ring.reserve(capacity ? capacity * 2 : 16);
+			for(usize i = 0; i < worker.count; ++i)
+				ring.insert_back(worker.ring[(worker.head + i) % capacity]);
+			while(ring.count() < (capacity ? capacity * 2 : 16))
+				ring.insert_back(Task{});
+			worker.ring = std::move(ring);
+			worker.head = 0;
+			capacity = worker.ring.count();
+		}
+		worker.ring[(worker.head + worker.count) % capacity] = task;
+		++worker.count;
+	}
+
+	static bool
+	_queue_pop(Task_Worker& worker, Task& task, bool back)
+	{
+		std::lock_guard<std::mutex> lock(worker.mutex);
+		if(worker.count == 0)
+			return false;
+
+		usize capacity = worker.ring.count();
+		if(back)
+		{
+			task = worker.ring[(worker.head + worker.count - 1) % capacity];
+		}
+		else
+		{
+			task = worker.ring[worker.head];
+			worker.head = (worker.head + 1) % capacity;
+		}
+		--worker.count;
+		return true;
+	}
+
+	static void
+	_affinity_set(std::thread& thread, i32 cpu)
+	{
+		#if defined(OS_WINDOWS)
+			SetThreadAffinityMask(thread.native_handle(), DWORD_PTR(1) << cpu);
+		#elif defined(OS_LINUX)
+			cpu_set_t set;
+			CPU_ZERO(&set);
+			CPU_SET(cpu, &set);
+			pthread_setaffinity_np(thread.native_handle(), sizeof(set), &set);
+		#endif
+	}
+
+	static void
+	_worker_main(Thread_Pool* pool, usize index)
+	{
+		_worker_pool = pool;
+		_worker_index = index;
+
+		Task task{};
+		while(true)
+		{
+			if(pool->_task_take(index, task))
+			{
+				pool->_task_run(task);
+				continue;
+			}
+
+			std::unique_lock<std::mutex> lock(pool->_mutex);
+			pool->_wake.wait(lock, [pool]{
+				return pool->_stop || pool->_queued.load() > 0;
+			});
+			if(pool->_stop && pool->_queued.load() == 0)
+				break;
+		}
+	}
+
+	Thread_Pool::Thread_Pool(const Thread_Pool_Config& config)
+		:_queued(0),
+		 _next(0),
+		 _stop(false)
+	{
+		usize count = config.workers_count;
+		if(count == 0)
+			count = std::thread::hardware_concurrency();
+		if(count == 0)
+			count = 1;
+
+		//the workers hold their mutex so they're allocated one by one and keep their address
+		_workers.reserve(count);
+		for(usize i = 0; i < count; ++i)
+			_workers.insert_back(::new(alloc<Task_Worker>().ptr) Task_Worker{ {}, Dynamic_Array<Task>(), 0, 0 });
+
+		_threads.reserve(count);
+		for(usize i = 0; i < count; ++i)
+		{
+			_threads.emplace_back(_worker_main, this, i);
+			if(i < config.affinity.count() && config.affinity[i] >= 0)
+				_affinity_set(_threads[i], config.affinity[i]);
+		}
+	}
+
+	Thread_Pool::~Thread_Pool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+			_stop = true;
+		}
+		_wake.notify_all();
+
+		for(auto& thread: _threads)
+			thread.join();
+		for(Task_Worker* worker: _workers)
+		{
+			worker->~Task_Worker();
+			free(Owner<Task_Worker>(worker, 1));
+		}
+	}
+
+	usize
+	Thread_Pool::workers_count() const
+	{
+		return _workers.count();
+	}
+
+	void
+	Thread_Pool::submit(Task_Group& group, Task_Function function, void* user_data)
+	{
+		group.pending.fetch_add(1);
+
+		usize index = _worker_pool == this ? _worker_index : _next.fetch_add(1) % _workers.count();
+		_queued.fetch_add(1);
+		_queue_push(*_workers[index], Task{ function, user_data, &group });
+
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+		}
+		_wake.notify_one();
+	}
+
+	void
+	Thread_Pool::wait(Task_Group& group)
+	{
+		usize worker = _worker_pool == this ? _worker_index : usize(-1);
+		Task task{};
+		while(group.pending.load() > 0)
+		{
+			if(_task_take(worker, task))
+			{
+				_task_run(task);
+				continue;
+			}
+
+			std::unique_lock<std::mutex> lock(_mutex);
+			_wake.wait(lock, [this, &group]{
+				return group.pending.load() == 0 || _queued.load() > 0;
+			});
+		}
+	}
+
+	void
+	Thread_Pool::wait_for_work(const std::atomic<bool>& flag)
+	{
+		std::unique_lock<std::mutex> lock(_mutex);
+		_wake.wait(lock, [this, &flag]{
+			return flag.load() || _queued.load() > 0;
+		});
+	}
+
+	void
+	Thread_Pool::wake()
+	{
+		{
+			std::lock_guard<std::mutex> lock(_mutex);
+		}
+		_wake.notify_all();
+	}
+
+	bool
+	Thread_Pool::_task_take(usize worker, Task& task)
+	{
+		usize count = _workers.count();
+		if(worker != usize(-1) && _queue_pop(*_workers[worker], task, true))
+		{
+			_queued.fetch_sub(1);
+			return true;
+		}
+
+		usize start = worker != usize(-1) ? worker + 1 : _next.load();
+		for(usize i = 0; i < count; ++i)
+		{
+			usize victim = (start + i) % count;
+			if(victim == worker)
+				continue;
+			if(_queue_pop(*_workers[victim], task, false))
+			{
+				_queued.fetch_sub(1);
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void
+	Thread_Pool::_task_run(const Task& task)
+	{
+		task.function(task.user_data);
+
+		//the group could be freed by its waiter as soon as it's done so it's not touched after that
+		if(task.group->pending.fetch_sub(1) == 1)
+		{
+			{
+				std::lock_guard<std::mutex> lock(_mutex);
+			}
+			_wake.notify_all();
+		}
+	}
+
+	void
+	thread_pool_set(Thread_Pool* pool)
+	{
+		_global_pool.store(pool);
+	}
+
+	Thread_Pool*
+	thread_pool()
+	{
+		return _global_pool.load();
+	}
+}
@@ -0,0 +1,276 @@
+#include "pensieve/Vfs.h"
+
+namespace pnsv
+{
+	static u64
+	_path_hash(const String& path)
+	{
+		auto bytes = path.all().bytes;
+		return hash64(bytes.ptr, bytes.size);
+	}
+
+	Vfs::Vfs(usize max_open)
+		:max_open_files(max_open == 0 ? 1 : max_open),
+		 open_files(0),
+		 cache(nullptr),
+		 _index_count(0),
+		 _tick(0)
+	{}
+
+	Pensieve::ERROR_CODE
+	Vfs::mount(const char* path)
+	{
+		//mounting opens the shard file so the least recently used shard gives its file up first
+		if(open_files >= max_open_files)
+			_shard_evict();
+
+		shards.emplace_back();
+		usize shard_index = shards.count() - 1;
+		auto& shard = shards[shard_index];
+
+		auto result = shard.archive.mount_from_disk(path);
+		if(result != Pensieve::ERROR_OK)
+		{
+			shards.remove_back();
+			return result;
+		}
+		shard.path = path;
+		shard.archive.cache = cache;
+		shard.last_use = ++_tick;
+		++open_files;
+
+		const auto& files = shard.archive.header.files;
+		for(usize i = 0; i < files.count(); ++i)
+		{
+			//deleted entries have no name
+			if(files[i].name.empty())
+				continue;
+			_index_insert(Vfs_Handle { shard_index, Virtual_Handle { i } }, _path_hash(files[i].name));
+		}
+		return result;
+	}
+
+	Vfs_Handle
+	Vfs::file_open(const String& path) const
+	{
+		assert(valid_path(path.all()));
+
+		auto handle = _file_lookup(path);
+		//the entry is found through the index so the shard trace is recorded here
+		if(handle.valid() && shards[handle.shard].archive.trace)
+			shards[handle.shard].archive.trace->record(path);
+		return handle;
+	}
+
+	bool
+	Vfs::file_exists(const String& path) const
+	{
+		assert(valid_path(path.all()));
+		return _file_lookup(path).valid();
+	}
+
+	Vfs_Handle
+	Vfs::_file_lookup(const String& path) const
+	{
+		auto handle = _index_find(path, _path_hash(path));
+		if(handle.valid() && shards[handle.shard].archive.file_is_whiteout(handle.handle))
+			return INVALID_VFS_HANDLE;
+		return handle;
+	}
+
+	const String&
+	Vfs::file_name(Vfs_Handle handle) const
+	{
+		assert(shards.count() > handle.shard);
+		return shards[handle.shard].archive.file_name(handle.handle);
+	}
+
+	u64
+	Vfs::file_size(Vfs_Handle handle) const
+	{
+		assert(shards.count() > handle.shard);
+		return shards[handle.shard].archive.file_size(handle.handle);
+	}
+
+	File_Stat
+	Vfs::file_stat(Vfs_Handle handle) const
+	{
+		assert(shards.count() > handle.shard);
+		return shards[handle.shard].archive.file_stat(handle.handle);
+	}
+
+	Memory_Stream&
+	Vfs::file_stream(Vfs_Handle handle)
+	{
+		assert(shards.count() > handle.shard);
+		auto& archive = shards[handle.shard].archive;
+		usize index = archive.header.files[handle.handle.header_entry_index].index;
+		bool acquired = archive.content[index].lazy == false || _shard_acquire(handle.shard);
+		assert(acquired && "failed to open the shard file, use files_read_batch to handle the io errors");
+		(void)acquired;
+		return archive.file_stream(handle.handle);
+	}
+
+	usize
+	Vfs::file_read(Vfs_Handle handle, u64 offset, Slice<byte> data)
+	{
+		assert(shards.count() > handle.shard);
+		auto& archive = shards[handle.shard].archive;
+		usize index = archive.header.files[handle.handle.header_entry_index].index;
+		if(archive.content[index].lazy && _shard_acquire(handle.shard) == false)
+			return 0;
+		return archive.file_read(handle.handle, offset, data);
+	}
+
+	Dynamic_Array<Vfs_Handle>
+	Vfs::files_match(const String& pattern) const
+	{
+		Dynamic_Array<Vfs_Handle> result;
+		for(usize i = 0; i < shards.count(); ++i)
+		{
+			const auto& archive = shards[i].archive;
+			for(const auto& handle: archive.files_match(pattern))
+			{
+				//only the entries which own their path in the index are visible
+				const String& name = archive.file_name(handle);
+				auto owner = _index_find(name, _path_hash(name));
+				if(owner.shard != i || owner.handle.header_entry_index != handle.header_entry_index)
+					continue;
+				if(archive.file_is_whiteout(handle))
+					continue;
+				result.insert_back(owner);
+			}
+		}
+		return result;
+	}
+
+	bool
+	Vfs::files_read_batch(const Dynamic_Array<Vfs_Handle>& handles)
+	{
+		bool result = true;
+		for(usize i = 0; i < shards.count(); ++i)
+		{
+			Dynamic_Array<Virtual_Handle> shard_handles;
+			for(const auto& handle: handles)
+				if(handle.shard == i)
+					shard_handles.insert_back(handle.handle);
+
+			if(shard_handles.empty())
+				continue;
+
+			if(_shard_acquire(i) == false)
+			{
+				result = false;
+				continue;
+			}
+			result &= shards[i].archive.files_read_batch(shard_handles);
+		}
+		return result;
+	}
+
+	Vfs_Handle
+	Vfs::_index_find(const String& path, u64 hash) const
+	{
+		if(_index.empty())
+			return INVALID_VFS_HANDLE;
+
+		usize mask = _index.count() - 1;
+		for(usize i = usize(hash) & mask; ; i = (i + 1) & mask)
+		{
+			const auto& slot = _index[i];
+			if(slot.handle.valid() == false)
+				return INVALID_VFS_HANDLE;
+			if(slot.hash == hash && file_name(slot.handle) == path)
+				return slot.handle;
+		}
+	}
+
+	void
+	Vfs::_index_insert(Vfs_Handle handle, u64 hash)
+	{
+		//keep the load factor under 1/2 so the probe sequences stay short
+		if((_index_count + 1) * 2 > _index.count())
+			_index_grow();
+
+		const String& path = file_name(handle);
+		usize mask = _index.count() - 1;
+		for(usize i = usize(hash) & mask; ; i = (i + 1) & mask)
+		{
+			auto& slot = _index[i];
+			if(slot.handle.valid() == false)
+			{
+				slot = Index_Slot { hash, handle };
+				++_index_count;
+				return;
+			}
+
+			//the later mounted shard overrides the path
+			if(slot.hash == hash && file_name(slot.handle) == path)
+			{
+				slot.handle = handle;
+				return;
+			}
+		}
+	}
+
+	void
+	Vfs::_index_grow()
+	{
+		usize capacity = _index.empty() ? 64 : _index.count() * 2;
+		Dynamic_Array<Index_Slot> old(std::move(_index));
+
+		_index = Dynamic_Array<Index_Slot>();
+		_index.reserve(capacity);
+		for(usize i = 0; i < capacity; ++i)
+			_index.insert_back(Index_Slot { 0, INVALID_VFS_HANDLE });
+
+		usize mask = capacity - 1;
+		for(const auto& slot: old)
+		{
+			if(slot.handle.valid() == false)
+				continue;
+
+			usize i = usize(slot.hash) & mask;
+			while(_index[i].handle.valid())
+				i = (i + 1) & mask;
+			_index[i] = slot;
+		}
+	}
+
+	bool
+	Vfs::_shard_acquire(usize shard)
+	{
+		auto& s = shards[shard];
+		s.last_use = ++_tick;
+		if(s.archive.disk.valid())
+			return true;
+
+		if(open_files >= max_open_files)
+			_shard_evict();
+
+		s.archive.disk = disk_open(s.path.data(), IO_MODE::READ);
+		if(s.archive.disk.valid() == false)
+			return false;
+		++open_files;
+		return true;
+	}
+
+	void
+	Vfs::_shard_evict()
+	{
+		usize victim = usize(-1);
+		for(usize i = 0; i < shards.count(); ++i)
+		{
+			if(shards[i].archive.disk.valid() == false)
+				continue;
+			if(victim == usize(-1) || shards[i].last_use < shards[victim].last_use)
+				victim = i;
+		}
+
+		if(victim != usize(-1))
+		{
+			disk_close(shards[victim].archive.disk);
+			--open_files;
+		}
+	}
+}
@@ -0,0 +1,311 @@
+#include "pensieve/Volume_Set.h"
+#include "pensieve/Block_Cache.h"
+#include "pensieve/Thread_Pool.h"
+
+#include <string.h>
+#include <time.h>
+
+namespace pnsv
+{
+	struct Volume_Header
+	{
+		u32 magic;
+		u16 index;
+		u16 count;
+		u64 stripe_size;
+		u64 set_id;
+		u64 size;
+	};
+	static_assert(sizeof(Volume_Header) == Volume_Set::VOLUME_HEADER_SIZE, "volume header should be packed");
+
+	static u64
+	_set_id_new()
+	{
+		//splitmix64 over the time and the process wide archive counter
+		u64 x = u64(::time(nullptr)) * 0x9E3779B97F4A7C15ULL ^ archive_id_new();
+		x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+		x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+		return x ^ (x >> 31);
+	}
+
+	//transfers the stripes of the range which live on the given volume
+	//returns the logical offset of the first short transfer or the end of the range
+	static u64
+	_volume_transfer(const Volume_Set& set, usize volume, u64 offset, Slice<byte> data, bool write)
+	{
+		u64 count = set.files.count();
+		u64 end = offset + data.size;
+		u64 stripe = offset / set.stripe_size;
+		stripe += (volume + count - stripe % count) % count;
+
+		for(; stripe * set.stripe_size < end; stripe += count)
+		{
+			u64 stripe_start = stripe * set.stripe_size;
+			u64 start = stripe_start > offset ? stripe_start : offset;
+			u64 stop = stripe_start + set.stripe_size < end ? stripe_start + set.stripe_size : end;
+
+			u64 volume_offset = Volume_Set::VOLUME_HEADER_SIZE + (stripe / count) * set.stripe_size + (start - stripe_start);
+			auto part = make_slice(data.ptr + (start - offset), usize(stop - start));
+			usize done = 0;
+			if(write)
+				done = disk_write_at(set.files[volume], volume_offset, part);
+			else
+				done = disk_read_at(set.files[volume], volume_offset, part);
+
+			if(done < part.size)
+				return start + done;
+		}
+		return end;
+	}
+
+	struct Volume_Transfer
+	{
+		const Volume_Set* set;
+		usize volume;
+		u64 offset;
+		Slice<byte> data;
+		bool write;
+		u64 end;
+	};
+
+	static void
+	_volume_transfer_run(void* user_data)
+	{
+		Volume_Transfer* transfer = static_cast<Volume_Transfer*>(user_data);
+		transfer->end = _volume_transfer(*transfer->set, transfer->volume, transfer->offset, transfer->data, transfer->write);
+	}
+
+	static usize
+	_volumes_transfer(const Volume_Set& set, u64 offset, Slice<byte> data, bool write)
+	{
+		if(data.size == 0 || set.valid() == false)
+			return 0;
+
+		u64 count = set.files.count();
+		u64 first_stripe = offset / set.stripe_size;
+		u64 last_stripe = (offset + data.size - 1) / set.stripe_size;
+		usize volumes_count = usize(last_stripe - first_stripe + 1 < count ? last_stripe - first_stripe + 1 : count);
+
+		if(volumes_count == 1)
+			return usize(_volume_transfer(set, usize(first_stripe % count), offset, data, write) - offset);
+
+		Dynamic_Array<Volume_Transfer> transfers;
+		transfers.reserve(volumes_count);
+		for(usize i = 0; i < volumes_count; ++i)
+			transfers.insert_back(Volume_Transfer{ &set, usize((first_stripe + i) % count), offset, data, write, offset + data.size });
+
+		//the first volume is done on the calling thread and the rest go to the shared pool
+		//without a pool they all run on the calling thread one after the other since the library doesn't start threads
+		Thread_Pool* pool = thread_pool();
+		Task_Group group;
+		for(usize i = 1; i < volumes_count; ++i)
+		{
+			if(pool)
+				pool->submit(group, _volume_transfer_run, &transfers[i]);
+			else
+				_volume_transfer_run(&transfers[i]);
+		}
+		_volume_transfer_run(&transfers[0]);
+		if(pool)
+			pool->wait(group);
+
+		u64 end = offset + data.size;
+		for(const auto& transfer: transfers)
+			if(transfer.end < end)
+				end = transfer.end;
+		return usize(end - offset);
+	}
+
+	Volume_Set::Volume_Set()
+		:stripe_size(DEFAULT_STRIPE_SIZE),
+		 set_id(0),
+		 size(0),
+		 writable(false)
+	{}
+
+	Volume_Set::~Volume_Set()
+	{
+		close();
+	}
+
+	bool
+	Volume_Set::create(const Dynamic_Array<String>& paths, u64 stripe)
+	{
+		close();
+		if(paths.empty() || paths.count() > 0xFFFF)
+			return false;
+
+		for(const auto& path: paths)
+		{
+			Disk_File file = disk_open(path.data(), IO_MODE::WRITE);
+			if(file.valid() == false)
+			{
+				close();
+				return false;
+			}
+			files.insert_back(file);
+		}
+
+		stripe_size = stripe == 0 ? DEFAULT_STRIPE_SIZE : (stripe + 4095) & ~u64(4095);
+		set_id = _set_id_new();
+		size = 0;
+		writable = true;
+		return true;
+	}
+
+	bool
+	Volume_Set::open(const Dynamic_Array<String>& paths)
+	{
+		close();
+		if(paths.empty())
+			return false;
+
+		Volume_Header first{};
+		for(usize i = 0; i < paths.count(); ++i)
+		{
+			Disk_File file = disk_open(paths[i].data(), IO_MODE::READ);
+			if(file.valid() == false)
+			{
+				close();
+				return false;
+			}
+			files.insert_back(file);
+
+			Volume_Header header{};
+			bool ok = disk_read_at(file, 0, make_slice(reinterpret_cast<byte*>(&header), sizeof(header))) == sizeof(header);
+			ok = ok && header.magic == VOLUME_MAGIC && header.index == i && header.count == paths.count() && header.stripe_size > 0;
+			if(ok && i > 0)
+				ok = header.stripe_size == first.stripe_size && header.set_id == first.set_id && header.size == first.size;
+			if(ok == false)
+			{
+				close();
+				return false;
+			}
+
+			if(i == 0)
+				first = header;
+		}
+
+		stripe_size = first.stripe_size;
+		set_id = first.set_id;
+		size = first.size;
+		writable = false;
+		return true;
+	}
+
+	bool
+	Volume_Set::close()
+	{
+		bool result = true;
+		for(usize i = 0; i < files.count(); ++i)
+		{
+			if(writable)
+			{
+				Volume_Header header{ VOLUME_MAGIC, u16(i), u16(files.count()), stripe_size, set_id, size };
+				auto data = make_slice(reinterpret_cast<byte*>(&header), sizeof(header));
+				if(disk_write_at(files[i], 0, data) != sizeof(header))
+					result = false;
+			}
+			disk_close(files[i]);
+		}
+		files.clear();
+		writable = false;
+		return result;
+	}
+
+	usize
+	Volume_Set::read(u64 offset, Slice<byte> data) const
+	{
+		if(offset >= size)
+			return 0;
+		if(data.size > size - offset)
+			data.size = usize(size - offset);
+		return _volumes_transfer(*this, offset, data, false);
+	}
+
+	usize
+	Volume_Set::write(u64 offset, Slice<byte> data)
+	{
+		if(writable == false)
+			return 0;
+
+		usize result = _volumes_transfer(*this, offset, data, true);
+		if(offset + result > size)
+			size = offset + result;
+		return result;
+	}
+
+	static usize
+	_volume_writer_write(void* self, const Slice<byte>& data)
+	{
+		return static_cast<Volume_Writer*>(self)->write(data);
+	}
+
+	static usize
+	_volume_writer_read(void*, Slice<byte>&)
+	{
+		return 0;
+	}
+
+	Volume_Writer::Volume_Writer(Volume_Set& volume_set, u64 start_offset)
+		:set(&volume_set),
+		 _buffered(0),
+		 offset(start_offset),
+		 failed(false)
+	{
+		_io_trait._self = this;
+		_io_trait._write = _volume_writer_write;
+		_io_trait._read = _volume_writer_read;
+	}
+
+	Volume_Writer::~Volume_Writer()
+	{
+		if(_buffer.ptr)
+			free(_buffer);
+	}
+
+	usize
+	Volume_Writer::write(const Slice<byte>& data)
+	{
+		usize flush_size = usize(set->stripe_size * set->files.count());
+		usize done = 0;
+		while(done < data.size && failed == false)
+		{
+			//a write which covers all the volumes on its own skips the buffer
+			if(_buffered == 0 && data.size - done >= flush_size)
+			{
+				auto part = make_slice(data.ptr + done, data.size - done);
+				if(set->write(offset, part) != part.size)
+					failed = true;
+				offset += part.size;
+				done = data.size;
+				continue;
+			}
+
+			if(_buffer.ptr == nullptr)
+				_buffer = alloc<byte>(flush_size);
+
+			usize size = data.size - done < flush_size - _buffered ? data.size - done : flush_size - _buffered;
+			::memcpy(_buffer.ptr + _buffered, data.ptr + done, size);
+			_buffered += size;
+			done += size;
+
+			if(_buffered == flush_size)
+				flush();
+		}
+		return failed ? 0 : data.size;
+	}
+
+	bool
+	Volume_Writer::flush()
+	{
+		if(_buffered > 0 && failed == false)
+		{
+			if(set->write(offset, make_slice(_buffer.ptr, _buffered)) != _buffered)
+				failed = true;
+			offset += _buffered;
+		}
+		_buffered = 0;
+		return failed == false;
+	}
+}
@@ -1,6 +1,9 @@
 #include <cpprelude/IO.h>
 #include <cpprelude/File.h>
 #include <pensieve/Pensieve.h>
+#include <pensieve/Delta.h>
+
+#include <algorithm>
 
 using namespace cppr;
 using namespace pnsv;
@@ -25,6 +28,10 @@ print_usage()
 	println("\t-version: prints the version of library");
 	println("\t-verbose: verbosely does the operation");
 	println("\t-check: check the file correctness");
+	println("\t-stats: prints the files count, the chunks count and the dedup ratio");
+	println("\t-layout <trace>: rewrites the files with the chunks ordered by the access trace");
+	println("\t-diff <old> <new> <patch>: writes the patch which turns the old archive into the new one");
+	println("\t-apply <old> <patch> <new>: writes the new archive from the old one and the patch");
 }
 
 struct Options
@@ -33,6 +40,10 @@ struct Options
 	bool version;
 	bool check;
 	bool verbose;
+	bool stats;
+	const char* layout;
+	const char* diff[3];
+	const char* apply[3];
 };
 
 Options
@@ -66,6 +77,34 @@ parse_options(i32& argc, char**& argv)
 			++argv;
 			opts.check = true;
 		}
+		else if(strcmp(*argv, "-stats") == 0)
+		{
+			--argc;
+			++argv;
+			opts.stats = true;
+		}
+		else if(strcmp(*argv, "-layout") == 0 && argc > 1)
+		{
+			opts.layout = argv[1];
+			argc -= 2;
+			argv += 2;
+		}
+		else if(strcmp(*argv, "-diff") == 0 && argc > 3)
+		{
+			opts.diff[0] = argv[1];
+			opts.diff[1] = argv[2];
+			opts.diff[2] = argv[3];
+			argc -= 4;
+			argv += 4;
+		}
+		else if(strcmp(*argv, "-apply") == 0 && argc > 3)
+		{
+			opts.apply[0] = argv[1];
+			opts.apply[1] = argv[2];
+			opts.apply[2] = argv[3];
+			argc -= 4;
+			argv += 4;
+		}
 		else
 		{
 			break;
@@ -89,9 +128,13 @@ parse_options(i32& argc, char**& argv)
 	return;\
 }
 
+//the header is decoded from the io and the chunks are read from the file after it
 void
-_load_version_1(IO_Trait* io)
+_load_version_1(IO_Trait* io, Disk_File file, u16 major)
 {
+	//magic + major + minor
+	u64 header_size = 8;
+
 	u64 data_length = 0;
 	ASSERT_READ(vreadb(io, data_length) == 8);
 	printfmt("data length: {}\n", data_length);
@@ -101,6 +144,9 @@ _load_version_1(IO_Trait* io)
 	ASSERT_READ(vreadb(io, files_count) == 4);
 	printfmt("files count: {}\n", files_count);
 	c = crc32_slurp(c, &files_count, 4);
+	header_size += 8 + 4;
+
+	Dynamic_Array<u64> offsets;
 
 	for(usize i = 0; i < files_count; ++i)
 	{
@@ -119,33 +165,90 @@ _load_version_1(IO_Trait* io)
 		c = crc32_slurp(c, filename_data.ptr, filename_data.size);
 
 		printfmt("filename: `{}`\n", filename_data.ptr);
+		header_size += 2 + filename_size;
+
+		u8 flags = 0;
+		if(major >= 3)
+		{
+			ASSERT_READ(vreadb(io, flags) == 1);
+			c = crc32_slurp(c, &flags, 1);
+			printfmt("flags: 0x{:0>2X}\n", flags);
+			header_size += 1;
+		}
+
+		if(major >= 4)
+		{
+			u64 file_size = 0, mtime = 0;
+			u8 tags_size = 0;
+			ASSERT_READ(vreadb(io, file_size, mtime, tags_size) == 17);
+			c = crc32_slurp(c, &file_size, 8);
+			c = crc32_slurp(c, &mtime, 8);
+			c = crc32_slurp(c, &tags_size, 1);
+			printfmt("file size: {}\n", file_size);
+			printfmt("mtime: {}\n", mtime);
+
+			auto tags_data = alloc<byte>(tags_size);
+			ASSERT_READ(vreadb(io, tags_data.all()) == tags_size);
+			c = crc32_slurp(c, tags_data.ptr, tags_size);
+			printfmt("tags: `{}`\n", make_strrng(tags_data, tags_size));
+			free(tags_data);
+			header_size += 17 + tags_size;
+		}
+
+		if(flags & ENTRY_FLAG_INLINE)
+		{
+			u32 inline_size = 0;
+			ASSERT_READ(vreadb(io, inline_size) == 4);
+			c = crc32_slurp(c, &inline_size, 4);
+			printfmt("inline size: {}\n", inline_size);
+
+			auto buffer = alloc<byte>(inline_size);
+			ASSERT_READ(vreadb(io, buffer.all()) == inline_size);
+			c = crc32_slurp(c, buffer.ptr, inline_size);
+			printfmt("inline data: `{}`...\n", make_strrng(buffer, inline_size > 32 ? 32 : inline_size));
+			free(buffer);
+			header_size += 4 + inline_size;
+			continue;
+		}
 
 		u64 file_offset = 0;
 		ASSERT_READ(vreadb(io, file_offset) == 8);
 		c = crc32_slurp(c, &file_offset, 8);
 		printfmt("file offset: {}\n", file_offset);
+		offsets.insert_back(file_offset);
+		header_size += 8;
 	}
 
 	u32 crc = 0;
 	ASSERT_READ(vreadb(io, crc) == 4);
 	ASSERT_FAIL("[Error]: CRC mismatch, header corrupted", c == crc);
+	header_size += 4;
 
 	printfmt("[BINARY CHUNKS SECTION]\n");
 
+	//files with the same content share one chunk
+	usize chunks_count = 0;
+	if(offsets.empty() == false)
+	{
+		std::sort(&offsets[0], &offsets[0] + offsets.count());
+		chunks_count = std::unique(&offsets[0], &offsets[0] + offsets.count()) - &offsets[0];
+	}
+	printfmt("chunks count: {}\n", chunks_count);
+
 	u64 acc = 0;
-	for(usize i = 0; i < files_count; ++i)
+	for(usize i = 0; i < chunks_count; ++i)
 	{
 		u64 bin_size = 0;
-		ASSERT_READ(vreadb(io, bin_size) == 8);
+		ASSERT_READ(disk_read_at(file, header_size + acc, make_slice(reinterpret_cast<byte*>(&bin_size), 8)) == 8);
 		printfmt("chunk size: {}\n", bin_size);
 		printfmt("chunk offset: {}\n", acc);
 		auto buffer = alloc<byte>(bin_size);
-		ASSERT_READ(vreadb(io, buffer.all()) == bin_size);
+		ASSERT_READ(disk_read_at(file, header_size + acc + 8, buffer.all()) == bin_size);
 
 		printfmt("chunk data: `{}`...\n", make_strrng(buffer, bin_size > 32 ? 32 : bin_size));
 
 		free(buffer);
-		acc += bin_size;
+		acc += bin_size + sizeof(u64);
 	}
 
 	printfmt("[END OF FILE]\n");
@@ -153,7 +256,7 @@ _load_version_1(IO_Trait* io)
 }
 
 void
-load_from_stream(IO_Trait* io)
+load_from_stream(IO_Trait* io, Disk_File file)
 {
 	u32 magic = 0;
 	ASSERT_READ(vreadb(io, magic) == 4)
@@ -167,8 +270,12 @@ load_from_stream(IO_Trait* io)
 
 	switch(major)
 	{
+		//version 2 has the same layout, version 3 adds the entries flags and version 4 their metadata
 		case 1:
-			_load_version_1(io);
+		case 2:
+		case 3:
+		case 4:
+			_load_version_1(io, file, major);
 	}
 }
 
@@ -180,13 +287,18 @@ check_file(const String& filename, const Options& opts)
 {
 	if(opts.verbose)
 	{
-		auto result = File::open(filename.data(), IO_MODE::READ, OPEN_MODE::OPEN_ONLY);
-		if(result.error != OS_ERROR::OK)
+		Disk_File file = disk_open(filename.data(), IO_MODE::READ);
+		if(file.valid() == false)
 		{
 			printfmt("[Error]: file doesnot exist\n");
 			return;
 		}
-		load_from_stream(result.value);
+
+		//the header is read in one block instead of a read per field
+		Memory_Stream block;
+		archive_header_read(file, block);
+		load_from_stream(block, file);
+		disk_close(file);
 	}
 	else
 	{
@@ -214,10 +326,78 @@ check_file(const String& filename, const Options& opts)
 			case Pensieve::ERROR_HEADER_CORRUPTED:
 				printfmt("[Error]: header is corrupted\n");
 				break;
+
+			case Pensieve::ERROR_CANCELLED:
+				printfmt("[Error]: cancelled\n");
+				break;
+
+			case Pensieve::ERROR_WRITE_FAILED:
+				printfmt("[Error]: failed to write the file\n");
+				break;
 		}
 	}
 }
 
+void
+print_stats(const String& filename)
+{
+	Pensieve pn;
+	auto err = pn.mount_from_disk(filename.data());
+	if(err != Pensieve::ERROR_OK)
+	{
+		printfmt("[Error]: failed to load the file, error code: {}\n", err);
+		return;
+	}
+
+	auto stats = pn.stats();
+	printfmt("files count: {}\n", stats.files_count);
+	printfmt("chunks count: {}\n", stats.chunks_count);
+	printfmt("logical size: {}\n", stats.logical_size);
+	printfmt("stored size: {}\n", stats.stored_size);
+	printfmt("dedup ratio: {}\n", stats.dedup_ratio());
+}
+
+void
+layout_file(const String& filename, const Access_Trace& trace)
+{
+	Pensieve pn;
+	auto err = pn.mount_from_disk(filename.data());
+	if(err != Pensieve::ERROR_OK)
+	{
+		printfmt("[Error]: failed to load the file, error code: {}\n", err);
+		return;
+	}
+
+	pn.layout = &trace;
+	if(pn.save_on_disk(filename.data()) == false)
+		printfmt("[Error]: failed to save the file\n");
+}
+
+void
+diff_files(const char* old_path, const char* new_path, const char* patch_path)
+{
+	Delta_Stats stats{};
+	if(archive_diff(old_path, new_path, patch_path, &stats) == false)
+	{
+		printfmt("[Error]: failed to write the patch\n");
+		return;
+	}
+
+	printfmt("kept files: {}\n", stats.kept);
+	printfmt("copied files: {}\n", stats.copied);
+	printfmt("added files: {}\n", stats.added);
+	printfmt("delta files: {}\n", stats.deltas);
+	printfmt("reused bytes: {}\n", stats.reused_bytes);
+	printfmt("literal bytes: {}\n", stats.literal_bytes);
+}
+
+void
+apply_patch(const char* old_path, const char* patch_path, const char* new_path)
+{
+	if(archive_patch(old_path, patch_path, new_path) == false)
+		printfmt("[Error]: failed to apply the patch\n");
+}
+
 int
 main(int argc, char** argv)
 {
@@ -256,6 +436,35 @@ main(int argc, char** argv)
 			check_file(file, opts);
 		exit(0);
 	}
+	else if(opts.stats)
+	{
+		for(const auto& file: files)
+			print_stats(file);
+		exit(0);
+	}
+	else if(opts.layout)
+	{
+		Access_Trace trace;
+		if(trace.load_from_disk(opts.layout) == false)
+		{
+			printfmt("[Error]: failed to load the access trace\n");
+			exit(-1);
+		}
+
+		for(const auto& file: files)
+			layout_file(file, trace);
+		exit(0);
+	}
+	else if(opts.diff[0])
+	{
+		diff_files(opts.diff[0], opts.diff[1], opts.diff[2]);
+		exit(0);
+	}
+	else if(opts.apply[0])
+	{
+		apply_patch(opts.apply[0], opts.apply[1], opts.apply[2]);
+		exit(0);
+	}
 	else
 	{
 		print_usage();
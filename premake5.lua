@@ -24,4 +24,5 @@ workspace "pensieve"
 	include ("pensieve/pensieve.lua")
 	include ("scratch/scratch.lua")
 	include ("pnsv-cli/pnsv-cli.lua")
+	include ("benchmark/benchmark.lua")
 	include ("unittests/unittests.lua")
\ No newline at end of file
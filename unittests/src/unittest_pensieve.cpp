@@ -1,6 +1,16 @@
 #include <catch2/catch.hpp>
 
 #include <pensieve/Pensieve.h>
+#include <pensieve/Overlay.h>
+#include <pensieve/Vfs.h>
+#include <pensieve/Snapshot.h>
+#include <pensieve/Table.h>
+#include <pensieve/Delta.h>
+
+#include <algorithm>
+#include <atomic>
+#include <stdio.h>
+#include <string.h>
 
 using namespace pnsv;
 
@@ -110,5 +120,1215 @@ TEST_CASE("Pensieve", "[pensieve]")
 				CHECK(i == ii);
 			}
 		}
+
+		//a stream which stops accepting writes partway fails the save
+		{
+			struct Full_Stream
+			{
+				IO_Trait _io_trait;
+				usize left;
+			};
+			Full_Stream full{};
+			full._io_trait._self = &full;
+			full._io_trait._write = [](void* self, const Slice<byte>& data) -> usize {
+				Full_Stream* stream = static_cast<Full_Stream*>(self);
+				usize size = data.size < stream->left ? data.size : stream->left;
+				stream->left -= size;
+				return size;
+			};
+			full._io_trait._read = [](void*, Slice<byte>&) -> usize { return 0; };
+
+			Pensieve pn;
+			Dynamic_Array<u32> values;
+			for(u32 i = 0; i < 64 * 1024; ++i)
+				values.insert_back(i);
+			pn.file_write(pn.file_create("/big"), &values[0], values.count());
+			pn.file_write(pn.file_create("/small"), "small", 5);
+
+			full.left = 1024;
+			CHECK(pn.save_to_stream(&full._io_trait) == false);
+			full.left = usize(-1);
+			CHECK(pn.save_to_stream(&full._io_trait) == true);
+		}
+
+		//a corrupted files count fails the load instead of allocating for it
+		{
+			Memory_Stream corrupted;
+			vprintb(corrupted, MAGIC, MAJOR, MINOR, u64(0), u32(0xFFFFFFFF));
+			corrupted.move_to_start();
+			Pensieve pn;
+			CHECK(pn.load_from_stream(corrupted) == Pensieve::ERROR_FILE_CORRUPTED);
+			CHECK(pn.header.files.count() == 0);
+		}
+
+		//a truncated archive fails the loads without leaving its entries behind
+		auto data = disk.bin_content();
+		Memory_Stream truncated;
+		vprintb(truncated, make_slice(data.ptr, data.size - 4));
+		truncated.move_to_start();
+		FILE* f = ::fopen("unittest_truncated.pnsv", "wb");
+		REQUIRE(f != nullptr);
+		::fwrite(data.ptr, 1, data.size - 4, f);
+		::fclose(f);
+		{
+			Pensieve pn;
+			pn.file_create("/kept");
+			CHECK(pn.load_from_stream(truncated) == Pensieve::ERROR_FILE_CORRUPTED);
+			CHECK(pn.mount_from_disk("unittest_truncated.pnsv") == Pensieve::ERROR_FILE_CORRUPTED);
+			CHECK(pn.load_from_disk("unittest_truncated.pnsv") == Pensieve::ERROR_FILE_CORRUPTED);
+			CHECK(pn.header.files.count() == 1);
+			CHECK(pn.content.count() == 1);
+			CHECK(pn.file_exists("/usr/data") == false);
+		}
+		::remove("unittest_truncated.pnsv");
+	}
+
+	SECTION("mount batch read")
+	{
+		{
+			const char* names[] = { "/f0", "/f1", "/f2", "/f3", "/f4" };
+			Pensieve pn;
+			for(usize i = 0; i < 5; ++i)
+			{
+				auto h = pn.file_create(names[i]);
+				IO_Trait* io = pn.file_stream(h);
+				for(usize j = 0; j <= i; ++j)
+					vprintb(io, j + i * 100);
+			}
+			CHECK(pn.save_on_disk("unittest_batch.pnsv") == true);
+		}
+
+		{
+			Pensieve pn;
+			CHECK(pn.mount_from_disk("unittest_batch.pnsv") == Pensieve::ERROR_OK);
+			CHECK(pn.total_data_size() == 15 * sizeof(usize));
+
+			Dynamic_Array<Virtual_Handle> handles;
+			handles.insert_back(pn.file_open("/f3"));
+			handles.insert_back(pn.file_open("/f1"));
+			handles.insert_back(pn.file_open("/f3"));
+			CHECK(pn.files_read_batch(handles) == true);
+
+			const Pensieve& cpn = pn;
+			CHECK(cpn.file_stream(pn.file_open("/f1")).size() == 2 * sizeof(usize));
+			CHECK(cpn.file_stream(pn.file_open("/f3")).size() == 4 * sizeof(usize));
+
+			//files outside the batch are fetched on first use
+			IO_Trait* io = pn.file_stream(pn.file_open("/f4"));
+			for(usize j = 0; j <= 4; ++j)
+			{
+				usize v = 0;
+				CHECK(vreadb(io, v) == sizeof(usize));
+				CHECK(v == j + 400);
+			}
+		}
+		::remove("unittest_batch.pnsv");
+	}
+
+	SECTION("async save load")
+	{
+		const char* names[] = { "/a", "/b", "/c" };
+		ASYNC_BACKEND backends[] = { ASYNC_BACKEND_BLOCKING, ASYNC_BACKEND_IO_URING };
+		for(auto backend: backends)
+		{
+			Async_IO aio(8, backend);
+
+			bool saved = false;
+			{
+				Pensieve pn;
+				for(usize i = 0; i < 3; ++i)
+				{
+					IO_Trait* io = pn.file_stream(pn.file_create(names[i]));
+					for(usize j = 0; j < 100; ++j)
+						vprintb(io, j * (i + 1));
+				}
+				CHECK(pn.save_async(aio, "unittest_async.pnsv", [](Pensieve*, bool ok, void* user_data){
+					*static_cast<bool*>(user_data) = ok;
+				}, &saved) == true);
+				aio.wait_all();
+			}
+			CHECK(saved == true);
+			//the temp file was moved over the target
+			CHECK(disk_open("unittest_async.pnsv.tmp", IO_MODE::READ).valid() == false);
+
+			bool loaded = false;
+			Pensieve pn;
+			CHECK(pn.load_async(aio, "unittest_async.pnsv", [](Pensieve*, bool ok, void* user_data){
+				*static_cast<bool*>(user_data) = ok;
+			}, &loaded) == Pensieve::ERROR_OK);
+			aio.wait_all();
+			CHECK(loaded == true);
+
+			//nothing is left to read but the callback still waits for the queue
+			bool read = false;
+			Dynamic_Array<Virtual_Handle> handles;
+			handles.insert_back(pn.file_open("/a"));
+			pn.read_async(aio, handles, [](Pensieve*, bool ok, void* user_data){
+				*static_cast<bool*>(user_data) = ok;
+			}, &read);
+			CHECK(read == false);
+			aio.wait_all();
+			CHECK(read == true);
+
+			const Pensieve& cpn = pn;
+			CHECK(cpn.file_stream(pn.file_open("/c")).size() == 100 * sizeof(usize));
+			IO_Trait* io = pn.file_stream(pn.file_open("/b"));
+			for(usize j = 0; j < 100; ++j)
+			{
+				usize v = 0;
+				CHECK(vreadb(io, v) == sizeof(usize));
+				CHECK(v == j * 2);
+			}
+		}
+		::remove("unittest_async.pnsv");
+	}
+
+	SECTION("dedup")
+	{
+		Memory_Stream disk;
+		{
+			Pensieve pn;
+			const char* names[] = { "/a", "/b", "/c", "/empty0", "/empty1" };
+			for(usize i = 0; i < 3; ++i)
+			{
+				IO_Trait* io = pn.file_stream(pn.file_create(names[i]));
+				for(usize j = 0; j < 10; ++j)
+					vprintb(io, i == 2 ? j * 2 : j);
+			}
+			pn.file_create(names[3]);
+			pn.file_create(names[4]);
+			pn.save_to_stream(disk);
+
+			auto stats = pn.stats();
+			CHECK(stats.files_count == 5);
+			CHECK(stats.chunks_count == 3);
+			CHECK(stats.logical_size == 30 * sizeof(usize));
+			CHECK(stats.stored_size == 20 * sizeof(usize));
+		}
+
+		disk.move_to_start();
+		{
+			Pensieve pn;
+			CHECK(pn.load_from_stream(disk) == Pensieve::ERROR_OK);
+			//the empty files are inline so each one of them gets its own content
+			CHECK(pn.stats().chunks_count == 4);
+
+			//writing to a shared file copies it first
+			IO_Trait* io = pn.file_stream(pn.file_open("/a"));
+			vprintb(io, usize(1));
+			const Pensieve& cpn = pn;
+			CHECK(cpn.file_stream(pn.file_open("/a")).size() == 10 * sizeof(usize));
+			CHECK(cpn.file_stream(pn.file_open("/b")).size() == 10 * sizeof(usize));
+			CHECK(pn.stats().chunks_count == 5);
+
+			CHECK(pn.file_remove("/b") == true);
+			CHECK(pn.stats().chunks_count == 4);
+			CHECK(pn.file_stream(pn.file_open("/empty1")).size() == 0);
+
+			//the released contents are dropped on save
+			Memory_Stream again;
+			CHECK(pn.save_to_stream(again) == true);
+			CHECK(pn.content.count() == pn.stats().chunks_count);
+			CHECK(cpn.file_stream(pn.file_open("/a")).size() == 10 * sizeof(usize));
+		}
+	}
+
+	SECTION("streamed files and range reads")
+	{
+		//bigger than the stream buffer so the copy takes multiple rounds
+		constexpr usize count = (STREAM_BUFFER_SIZE * 3) / sizeof(u64) + 7;
+		Memory_Stream source;
+		for(u64 i = 0; i < count; ++i)
+			vprintb(source, i);
+		source.move_to_start();
+
+		{
+			Pensieve pn;
+			auto h = pn.file_create_from_stream("/big", source, count * sizeof(u64));
+			CHECK(pn.file_size(h) == count * sizeof(u64));
+			CHECK(pn.save_on_disk("unittest_stream.pnsv") == true);
+
+			//after saving the streamed file is read back from the disk
+			u64 value = 0;
+			CHECK(pn.file_read(h, 5 * sizeof(u64), make_slice(reinterpret_cast<byte*>(&value), sizeof(u64))) == sizeof(u64));
+			CHECK(value == 5);
+		}
+
+		{
+			Pensieve pn;
+			CHECK(pn.mount_from_disk("unittest_stream.pnsv") == Pensieve::ERROR_OK);
+			pn.file_create("/small");
+
+			//saving over the mounted file
+			CHECK(pn.save_on_disk("unittest_stream.pnsv") == true);
+
+			auto h = pn.file_open("/big");
+			u64 values[4] = {};
+			CHECK(pn.file_read(h, (count - 2) * sizeof(u64), make_slice(reinterpret_cast<byte*>(values), sizeof(values))) == 2 * sizeof(u64));
+			CHECK(values[0] == count - 2);
+			CHECK(values[1] == count - 1);
+			CHECK(pn.file_read(h, count * sizeof(u64), make_slice(reinterpret_cast<byte*>(values), sizeof(values))) == 0);
+		}
+
+		{
+			//a streamed file saved to a stream stays readable and is saved again in full
+			source.move_to_start();
+			Pensieve pn;
+			auto h = pn.file_create_from_stream("/big", source, count * sizeof(u64));
+			Memory_Stream first, second;
+			CHECK(pn.save_to_stream(first) == true);
+			CHECK(pn.save_to_stream(second) == true);
+			CHECK(first.size() == second.size());
+			CHECK(pn.file_size(h) == count * sizeof(u64));
+
+			//a short source fails the save and the saved file is left as it was
+			source.move_to_start();
+			pn.file_create_from_stream("/short", source, (count + 1) * sizeof(u64));
+			CHECK(pn.save_on_disk("unittest_stream.pnsv") == false);
+
+			Pensieve saved;
+			CHECK(saved.mount_from_disk("unittest_stream.pnsv") == Pensieve::ERROR_OK);
+			CHECK(saved.file_exists("/small") == true);
+			CHECK(saved.file_exists("/short") == false);
+		}
+		::remove("unittest_stream.pnsv");
+	}
+
+	SECTION("inline small files")
+	{
+		Memory_Stream disk;
+		{
+			Pensieve pn;
+			vprintb(pn.file_stream(pn.file_create("/flag")), u32(1));
+			vprintb(pn.file_stream(pn.file_create("/counter")), u64(42));
+			IO_Trait* io = pn.file_stream(pn.file_create("/big"));
+			for(usize i = 0; i < 100; ++i)
+				vprintb(io, i);
+			pn.save_to_stream(disk);
+		}
+
+		disk.move_to_start();
+		{
+			Pensieve pn;
+			CHECK(pn.load_from_stream(disk) == Pensieve::ERROR_OK);
+			u64 counter = 0;
+			CHECK(vreadb(pn.file_stream(pn.file_open("/counter")), counter) == sizeof(u64));
+			CHECK(counter == 42);
+			CHECK(pn.file_size(pn.file_open("/big")) == 100 * sizeof(usize));
+
+			//with inlining disabled the small files get their own chunks
+			pn.inline_threshold = 0;
+			Memory_Stream chunked;
+			pn.save_to_stream(chunked);
+			CHECK(chunked.size() > disk.size());
+		}
+	}
+
+	SECTION("overlay mounts")
+	{
+		{
+			Pensieve base;
+			vprintb(base.file_stream(base.file_create("/a")), u64(1));
+			vprintb(base.file_stream(base.file_create("/b")), u64(2));
+			vprintb(base.file_stream(base.file_create("/c")), u64(3));
+			CHECK(base.save_on_disk("unittest_base.pnsv") == true);
+
+			Pensieve patch;
+			vprintb(patch.file_stream(patch.file_create("/b")), u64(20));
+			vprintb(patch.file_stream(patch.file_create("/d")), u64(40));
+			patch.file_whiteout("/c");
+			CHECK(patch.save_on_disk("unittest_patch.pnsv") == true);
+
+			//outside of an overlay the whiteout isn't a file
+			CHECK(patch.file_open("/c").valid() == false);
+			CHECK(patch.file_exists("/c") == false);
+			CHECK(patch.files_match("/*").count() == 2);
+		}
+
+		{
+			Overlay overlay;
+			CHECK(overlay.mount("unittest_base.pnsv") == Pensieve::ERROR_OK);
+			CHECK(overlay.mount("unittest_patch.pnsv") == Pensieve::ERROR_OK);
+			CHECK(overlay.mount("unittest_missing.pnsv") != Pensieve::ERROR_OK);
+			CHECK(overlay.layers.count() == 2);
+
+			CHECK(overlay.file_open("/a").layer == 0);
+			CHECK(overlay.file_open("/b").layer == 1);
+			CHECK(overlay.file_open("/c").valid() == false);
+			CHECK(overlay.file_exists("/c") == false);
+			CHECK(overlay.file_open("/d").layer == 1);
+
+			u64 v = 0;
+			CHECK(vreadb(overlay.file_stream(overlay.file_open("/b")), v) == sizeof(u64));
+			CHECK(v == 20);
+			CHECK(overlay.file_read(overlay.file_open("/a"), 0, Slice<byte>{ (byte*)&v, sizeof(v) }) == sizeof(u64));
+			CHECK(v == 1);
+
+			auto files = overlay.files_match("/*");
+			REQUIRE(files.count() == 3);
+			CHECK(overlay.file_name(files[0]) == "/a");
+			CHECK(overlay.file_name(files[1]) == "/b");
+			CHECK(files[1].layer == 1);
+			CHECK(overlay.file_name(files[2]) == "/d");
+			CHECK(overlay.files_read_batch(files) == true);
+		}
+		::remove("unittest_base.pnsv");
+		::remove("unittest_patch.pnsv");
+	}
+
+	SECTION("vfs over shards")
+	{
+		const char* shards[] = { "unittest_shard0.pnsv", "unittest_shard1.pnsv", "unittest_shard2.pnsv" };
+		char name[32];
+		for(usize i = 0; i < 3; ++i)
+		{
+			Pensieve pn;
+			for(usize j = 0; j < 100; ++j)
+			{
+				snprintf(name, sizeof(name), "/s%zu/f%zu", i, j);
+				//big enough to not be inlined so the content is read from the shard
+				IO_Trait* io = pn.file_stream(pn.file_create(name));
+				for(usize k = 0; k < 16; ++k)
+					vprintb(io, u64(i * 1000 + j));
+			}
+			//the last shard overrides a file from the first one
+			if(i == 2)
+			{
+				IO_Trait* io = pn.file_stream(pn.file_create("/s0/f7"));
+				for(usize k = 0; k < 16; ++k)
+					vprintb(io, u64(7777));
+			}
+			CHECK(pn.save_on_disk(shards[i]) == true);
+		}
+
+		{
+			Vfs vfs(2);
+			for(usize i = 0; i < 3; ++i)
+				CHECK(vfs.mount(shards[i]) == Pensieve::ERROR_OK);
+			//mounting the third shard took the file of the least recently used one
+			CHECK(vfs.open_files == 2);
+			CHECK(vfs.shards[0].archive.disk.valid() == false);
+
+			u64 v = 0;
+			auto handle = vfs.file_open("/s1/f42");
+			REQUIRE(handle.valid());
+			CHECK(handle.shard == 1);
+			CHECK(vreadb(vfs.file_stream(handle), v) == sizeof(u64));
+			CHECK(v == 1042);
+
+			//the first shard isn't open so reading from it closes the least recently used one
+			handle = vfs.file_open("/s0/f99");
+			CHECK(vfs.file_read(handle, 0, Slice<byte>{ (byte*)&v, sizeof(v) }) == sizeof(u64));
+			CHECK(v == 99);
+			CHECK(vfs.open_files == 2);
+			CHECK(vfs.shards[2].archive.disk.valid() == false);
+
+			handle = vfs.file_open("/s0/f7");
+			CHECK(handle.shard == 2);
+			CHECK(vfs.file_read(handle, 0, Slice<byte>{ (byte*)&v, sizeof(v) }) == sizeof(u64));
+			CHECK(v == 7777);
+			CHECK(vfs.file_open("/s3/f0").valid() == false);
+
+			auto files = vfs.files_match("/s0/*");
+			CHECK(files.count() == 100);
+			CHECK(vfs.files_read_batch(files) == true);
+			CHECK(vfs.open_files <= 2);
+		}
+
+		for(usize i = 0; i < 3; ++i)
+			::remove(shards[i]);
+	}
+
+	SECTION("block cache")
+	{
+		{
+			Pensieve pn;
+			IO_Trait* io = pn.file_stream(pn.file_create("/big"));
+			for(u32 i = 0; i < 16 * 1024; ++i)
+				vprintb(io, i);
+			CHECK(pn.save_on_disk("unittest_cache.pnsv") == true);
+		}
+
+		{
+			Block_Cache cache(4 * 4096, 4096);
+			Pensieve pn;
+			pn.cache = &cache;
+			CHECK(pn.mount_from_disk("unittest_cache.pnsv") == Pensieve::ERROR_OK);
+			auto handle = pn.file_open("/big");
+
+			u32 values[8] = {};
+			Slice<byte> data{ (byte*)values, sizeof(values) };
+			CHECK(pn.file_read(handle, 100 * sizeof(u32), data) == sizeof(values));
+			CHECK(values[0] == 100);
+			CHECK(pn.file_read(handle, 104 * sizeof(u32), data) == sizeof(values));
+			CHECK(values[7] == 111);
+			CHECK(cache.stats().hits == 1);
+
+			//a read which spans two blocks
+			CHECK(pn.file_read(handle, 1020 * sizeof(u32), data) == sizeof(values));
+			for(u32 i = 0; i < 8; ++i)
+				CHECK(values[i] == 1020 + i);
+
+			//walking the whole file keeps the memory bounded by evicting the old blocks
+			for(u32 i = 0; i < 16 * 1024; i += 8)
+			{
+				CHECK(pn.file_read(handle, i * sizeof(u32), data) == sizeof(values));
+				CHECK(values[0] == i);
+			}
+
+			auto stats = cache.stats();
+			CHECK(stats.blocks_count == 4);
+			CHECK(stats.evictions > 0);
+			CHECK(stats.hits + stats.misses > 16 * 1024 / 8);
+
+			//the blocks of the old mount are dropped when the archive is mounted again
+			CHECK(pn.mount_from_disk("unittest_cache.pnsv") == Pensieve::ERROR_OK);
+			CHECK(cache.stats().blocks_count == 0);
+		}
+		::remove("unittest_cache.pnsv");
+	}
+
+	SECTION("access trace layout")
+	{
+		const char* names[] = { "/f0", "/f1", "/f2", "/f3", "/f4", "/f5" };
+		Pensieve pn;
+		for(usize i = 0; i < 6; ++i)
+		{
+			IO_Trait* io = pn.file_stream(pn.file_create(names[i]));
+			for(usize j = 0; j < 16; ++j)
+				vprintb(io, u64(i));
+		}
+
+		Access_Trace trace;
+		pn.trace = &trace;
+		pn.file_open("/f5");
+		pn.file_open("/f2");
+		pn.file_open("/f5");
+		pn.file_open("/f0");
+		pn.file_open("/missing");
+		pn.trace = nullptr;
+		REQUIRE(trace.paths.count() == 3);
+		CHECK(trace.paths[0] == "/f5");
+		CHECK(trace.save_to_disk("unittest_trace.bin") == true);
+
+		Access_Trace loaded;
+		CHECK(loaded.load_from_disk("unittest_trace.bin") == true);
+		REQUIRE(loaded.paths.count() == 3);
+		CHECK(loaded.paths[2] == "/f0");
+
+		pn.layout = &loaded;
+		CHECK(pn.save_on_disk("unittest_layout.pnsv") == true);
+
+		{
+			Pensieve mounted;
+			CHECK(mounted.mount_from_disk("unittest_layout.pnsv") == Pensieve::ERROR_OK);
+			auto offset_of = [&mounted](const char* name){
+				return mounted.content[mounted.header.files[mounted.file_open(name).header_entry_index].index].offset;
+			};
+			CHECK(offset_of("/f5") == 0);
+			CHECK(offset_of("/f5") < offset_of("/f2"));
+			CHECK(offset_of("/f2") < offset_of("/f0"));
+			CHECK(offset_of("/f0") < offset_of("/f1"));
+			CHECK(offset_of("/f1") < offset_of("/f3"));
+
+			CHECK(mounted.files_prefetch(loaded) == true);
+			CHECK(mounted.content[mounted.header.files[mounted.file_open("/f2").header_entry_index].index].lazy == false);
+			CHECK(mounted.content[mounted.header.files[mounted.file_open("/f4").header_entry_index].index].lazy == true);
+		}
+
+		{
+			//the overlay records the opens into the trace of the layer which owns the file
+			Access_Trace layer_trace;
+			Overlay overlay;
+			CHECK(overlay.mount("unittest_layout.pnsv") == Pensieve::ERROR_OK);
+			overlay.layers[0].trace = &layer_trace;
+			overlay.file_open("/f3");
+			overlay.file_open("/f1");
+			overlay.file_open("/f3");
+			CHECK(overlay.file_exists("/f4") == true);
+			REQUIRE(layer_trace.paths.count() == 2);
+			CHECK(layer_trace.paths[0] == "/f3");
+			CHECK(layer_trace.paths[1] == "/f1");
+		}
+		::remove("unittest_trace.bin");
+		::remove("unittest_layout.pnsv");
+	}
+
+	SECTION("typed views")
+	{
+		struct Point
+		{
+			r32 x, y;
+		};
+
+		{
+			Pensieve pn;
+			IO_Trait* io = pn.file_stream(pn.file_create("/numbers"));
+			for(u32 i = 0; i < 1000; ++i)
+				vprintb(io, i);
+			io = pn.file_stream(pn.file_create("/points"));
+			for(u32 i = 0; i < 10; ++i)
+				vprintb(io, Point{ r32(i), r32(i * 2) });
+			vprintb(pn.file_stream(pn.file_create("/odd")), u8(1), u8(2), u8(3));
+			CHECK(pn.save_on_disk("unittest_view.pnsv") == true);
+		}
+
+		{
+			Pensieve pn;
+			CHECK(pn.mount_from_disk("unittest_view.pnsv") == Pensieve::ERROR_OK);
+
+			const Pensieve& cpn = pn;
+			CHECK(cpn.file_view<u32>(pn.file_open("/numbers")).empty());
+			CHECK(cpn.file_view<u32>(pn.file_open("/numbers")).valid() == false);
+
+			auto numbers = pn.file_view<u32>(pn.file_open("/numbers"));
+			REQUIRE(numbers.count == 1000);
+			u32 expected = 0;
+			for(u32 v: numbers)
+				CHECK(v == expected++);
+
+			//once fetched the const view works too
+			CHECK(cpn.file_view<u32>(pn.file_open("/numbers")).count == 1000);
+
+			auto points = pn.file_view<Point>(pn.file_open("/points"));
+			REQUIRE(points.count == 10);
+			CHECK(points[9].y == 18.0f);
+
+			//3 bytes can't be viewed as u16
+			CHECK(pn.file_view<u16>(pn.file_open("/odd")).empty());
+			CHECK(pn.file_view<u16>(pn.file_open("/odd")).valid() == false);
+			CHECK(pn.file_view<u8>(pn.file_open("/odd")).valid() == true);
+			CHECK(pn.file_view<u8>(pn.file_open("/odd")).count == 3);
+		}
+		::remove("unittest_view.pnsv");
+	}
+
+	SECTION("bulk writes")
+	{
+		Pensieve pn;
+		auto handle = pn.file_create("/array");
+
+		u32 values[256];
+		for(u32 i = 0; i < 256; ++i)
+			values[i] = i;
+		pn.file_write(handle, values, 256);
+
+		auto region = pn.file_append_reserve(handle, 256 * sizeof(u32));
+		CHECK(region.size == 256 * sizeof(u32));
+		CHECK(pn.file_size(handle) == 512 * sizeof(u32));
+		CHECK(std::all_of(region.ptr, region.ptr + region.size, [](byte b) { return b == 0; }));
+		for(u32 i = 0; i < 256; ++i)
+		{
+			u32 v = 256 + i;
+			::memcpy(region.ptr + i * sizeof(u32), &v, sizeof(v));
+		}
+
+		//the stream is still usable after the bulk writes
+		vprintb(pn.file_stream(handle), u32(512));
+
+		auto copy = pn.file_create("/copy");
+		pn.file_write(copy, pn.file_view<u32>(handle));
+
+		auto view = pn.file_view<u32>(copy);
+		REQUIRE(view.count == 513);
+		for(u32 i = 0; i < 513; ++i)
+			CHECK(view[i] == i);
+	}
+
+	SECTION("adopted and borrowed buffers")
+	{
+		u64 borrowed[64];
+		for(u64 i = 0; i < 64; ++i)
+			borrowed[i] = i * 3;
+
+		{
+			Pensieve pn;
+			auto buffer = alloc<byte>(128 * sizeof(u32));
+			for(u32 i = 0; i < 128; ++i)
+				::memcpy(buffer.ptr + i * sizeof(u32), &i, sizeof(i));
+			byte* adopted = buffer.ptr;
+
+			auto handle = pn.file_create_from("/adopted", std::move(buffer));
+			CHECK(buffer.ptr == nullptr);
+			CHECK(pn.file_size(handle) == 128 * sizeof(u32));
+			//the view points to the adopted buffer itself
+			CHECK((const byte*)pn.file_view<u32>(handle).ptr == adopted);
+
+			pn.file_create_borrowed("/borrowed", (const byte*)borrowed, sizeof(borrowed));
+			pn.file_create_borrowed("/small", (const byte*)borrowed, 8);
+			CHECK(pn.file_create_from("/adopted", alloc<byte>(4)).valid() == false);
+
+			//a save to a stream keeps the borrowed memory and the same bytes share one chunk
+			auto twin = pn.file_create("/twin");
+			pn.file_write(twin, borrowed, 64);
+			Memory_Stream stream;
+			CHECK(pn.save_to_stream(stream) == true);
+			CHECK(pn.file_view<u64>(pn.file_open("/borrowed"))[63] == 189);
+			CHECK(pn.content.count() == 3);
+			CHECK(pn.save_on_disk("unittest_adopt.pnsv") == true);
+
+			//after the save the files are read from the archive
+			CHECK(pn.content[pn.header.files[handle.header_entry_index].index].external == nullptr);
+			CHECK(pn.file_view<u32>(handle)[127] == 127);
+		}
+
+		{
+			Pensieve pn;
+			CHECK(pn.load_from_disk("unittest_adopt.pnsv") == Pensieve::ERROR_OK);
+			auto numbers = pn.file_view<u32>(pn.file_open("/adopted"));
+			REQUIRE(numbers.count == 128);
+			CHECK(numbers[100] == 100);
+
+			auto values = pn.file_view<u64>(pn.file_open("/borrowed"));
+			REQUIRE(values.count == 64);
+			CHECK(values[63] == 189);
+			CHECK(pn.file_view<u64>(pn.file_open("/twin"))[63] == 189);
+			CHECK(pn.file_size(pn.file_open("/small")) == 8);
+		}
+		::remove("unittest_adopt.pnsv");
+	}
+
+	SECTION("file metadata")
+	{
+		{
+			Pensieve pn;
+			auto handle = pn.file_create("/texture");
+			pn.file_write(handle, "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef", 80);
+			pn.file_set_mtime(handle, 1500000000);
+			pn.file_set_tags(handle, "albedo;srgb");
+
+			auto long_data = alloc<byte>(300);
+			::memset(long_data.ptr, 'x', long_data.size);
+			pn.file_set_tags(pn.file_create("/long"), String(std::move(long_data)));
+			CHECK(pn.save_on_disk("unittest_stat.pnsv") == true);
+		}
+
+		{
+			Pensieve pn;
+			CHECK(pn.mount_from_disk("unittest_stat.pnsv") == Pensieve::ERROR_OK);
+			auto handle = pn.file_open("/texture");
+			auto stat = pn.file_stat(handle);
+			CHECK(stat.size == 80);
+			CHECK(stat.mtime == 1500000000);
+			REQUIRE(stat.tags.bytes.size == 11);
+			CHECK(::memcmp(stat.tags.bytes.ptr, "albedo;srgb", 11) == 0);
+			CHECK(pn.file_stat(pn.file_open("/long")).tags.bytes.size == MAX_TAGS_SIZE);
+
+			//the stat comes from the header so the content is still on disk
+			CHECK(pn.content[pn.header.files[handle.header_entry_index].index].lazy == true);
+
+			//writes and clears stamp the mtime
+			pn.file_write(handle, "x", 1);
+			CHECK(pn.file_stat(handle).mtime > 1500000000);
+			pn.file_set_mtime(handle, 1);
+			pn.file_clear(handle);
+			CHECK(pn.file_stat(handle).mtime > 1);
+		}
+		::remove("unittest_stat.pnsv");
+	}
+
+	SECTION("multi-volume archives")
+	{
+		Dynamic_Array<String> paths;
+		paths.insert_back("unittest_volume_0.pnsv");
+		paths.insert_back("unittest_volume_1.pnsv");
+		paths.insert_back("unittest_volume_2.pnsv");
+
+		{
+			Pensieve pn;
+			IO_Trait* io = pn.file_stream(pn.file_create("/big"));
+			for(u32 i = 0; i < 16 * 1024; ++i)
+				vprintb(io, i);
+			vprintb(pn.file_stream(pn.file_create("/small")), u32(7));
+
+			Volume_Set volumes;
+			CHECK(volumes.create(paths, 4096) == true);
+			CHECK(pn.save_on_volumes(volumes) == true);
+			CHECK(volumes.close() == true);
+		}
+
+		{
+			Volume_Set volumes;
+			REQUIRE(volumes.open(paths) == true);
+			Pensieve pn;
+			CHECK(pn.mount_from_volumes(volumes) == Pensieve::ERROR_OK);
+			auto handle = pn.file_open("/big");
+			CHECK(pn.file_size(handle) == 16 * 1024 * sizeof(u32));
+
+			//a range which covers all the volumes
+			Dynamic_Array<u32> values;
+			for(u32 i = 0; i < 4096; ++i)
+				values.insert_back(0);
+			Slice<byte> data{ (byte*)&values[0], values.count() * sizeof(u32) };
+			CHECK(pn.file_read(handle, 1000 * sizeof(u32), data) == data.size);
+			CHECK(values[0] == 1000);
+			CHECK(values[4095] == 5095);
+
+			Pensieve loaded;
+			CHECK(loaded.load_from_volumes(volumes) == Pensieve::ERROR_OK);
+			CHECK(loaded.volumes == nullptr);
+			auto numbers = loaded.file_view<u32>(loaded.file_open("/big"));
+			REQUIRE(numbers.count == 16 * 1024);
+			CHECK(numbers[16 * 1024 - 1] == 16 * 1024 - 1);
+			CHECK(loaded.file_view<u32>(loaded.file_open("/small"))[0] == 7);
+
+			//loading the set into a mounted archive keeps the archive id and cached blocks of the mount
+			{
+				Pensieve saved;
+				IO_Trait* disk_io = saved.file_stream(saved.file_create("/disk"));
+				for(u32 i = 0; i < 16 * 1024; ++i)
+					vprintb(disk_io, i + 9);
+				CHECK(saved.save_on_disk("unittest_volumes.pnsv") == true);
+			}
+			Block_Cache cache(4 * 4096, 4096);
+			Pensieve mixed;
+			mixed.cache = &cache;
+			CHECK(mixed.mount_from_disk("unittest_volumes.pnsv") == Pensieve::ERROR_OK);
+			u32 value = 0;
+			Slice<byte> value_data{ (byte*)&value, sizeof(value) };
+			CHECK(mixed.file_read(mixed.file_open("/disk"), 0, value_data) == sizeof(value));
+			usize blocks_count = cache.stats().blocks_count;
+			CHECK(blocks_count > 0);
+			u64 id = mixed.archive_id;
+			CHECK(mixed.load_from_volumes(volumes) == Pensieve::ERROR_OK);
+			CHECK(mixed.archive_id == id);
+			CHECK(cache.stats().blocks_count == blocks_count);
+			value = 0;
+			CHECK(mixed.file_read(mixed.file_open("/disk"), 0, value_data) == sizeof(value));
+			CHECK(value == 9);
+			CHECK(mixed.file_view<u32>(mixed.file_open("/small"))[0] == 7);
+		}
+		::remove("unittest_volumes.pnsv");
+
+		{
+			//the volumes should be given in their order
+			Dynamic_Array<String> swapped;
+			swapped.insert_back(paths[1]);
+			swapped.insert_back(paths[0]);
+			swapped.insert_back(paths[2]);
+			Volume_Set volumes;
+			CHECK(volumes.open(swapped) == false);
+		}
+
+		{
+			//a volume which lost its later stripes fails the load without leaving lazy entries behind
+			Dynamic_Array<byte> kept;
+			kept.expand_back(Volume_Set::VOLUME_HEADER_SIZE + 4096, 0);
+			FILE* f = ::fopen(paths[1].data(), "rb");
+			REQUIRE(f != nullptr);
+			CHECK(::fread(&kept[0], 1, kept.count(), f) == kept.count());
+			::fclose(f);
+			f = ::fopen(paths[1].data(), "wb");
+			REQUIRE(f != nullptr);
+			::fwrite(&kept[0], 1, kept.count(), f);
+			::fclose(f);
+
+			Volume_Set volumes;
+			REQUIRE(volumes.open(paths) == true);
+			Pensieve pn;
+			pn.file_create("/kept");
+			CHECK(pn.load_from_volumes(volumes) == Pensieve::ERROR_FILE_CORRUPTED);
+			CHECK(pn.header.files.count() == 1);
+			CHECK(pn.content.count() == 1);
+		}
+
+		for(const auto& path: paths)
+			::remove(path.data());
+	}
+
+	SECTION("snapshots")
+	{
+		Snapshot_Store store;
+		{
+			auto draft = store.draft();
+			vprintb(draft.archive.file_stream(draft.archive.file_create("/config")), u32(1));
+			vprintb(draft.archive.file_stream(draft.archive.file_create("/static")), u32(42));
+			CHECK(store.publish(draft) == true);
+		}
+
+		auto first = store.acquire();
+		CHECK(first->version == 1);
+		CHECK(first->archive.file_view<u32>(first->file_open("/config"))[0] == 1);
+
+		{
+			auto draft = store.draft();
+			auto stale = store.draft();
+			auto handle = draft.archive.file_open("/config");
+			draft.archive.file_clear(handle);
+			vprintb(draft.archive.file_stream(handle), u32(2));
+			draft.archive.file_remove(draft.archive.file_open("/static"));
+			draft.archive.file_create_from("/new", alloc<byte>(16));
+			CHECK(store.publish(draft) == true);
+
+			//the stale draft was made before the last publish
+			CHECK(store.publish(stale) == false);
+		}
+
+		//the old snapshot is unchanged while it's held
+		CHECK(first->archive.file_view<u32>(first->file_open("/config"))[0] == 1);
+		CHECK(first->file_open("/static").valid() == true);
+
+		auto second = store.acquire();
+		CHECK(second->version == 2);
+		CHECK(second->archive.file_view<u32>(second->file_open("/config"))[0] == 2);
+		CHECK(second->file_open("/static").valid() == false);
+		CHECK(second->archive.file_size(second->file_open("/new")) == 16);
+
+		{
+			//the unchanged files share their content with the previous snapshot
+			auto draft = store.draft();
+			draft.archive.file_create("/empty");
+			CHECK(store.publish(draft) == true);
+		}
+		auto third = store.acquire();
+		auto a = second->archive.file_view<u32>(second->file_open("/config"));
+		auto b = third->archive.file_view<u32>(third->file_open("/config"));
+		CHECK(a.ptr == b.ptr);
+
+		first.release();
+		store.collect();
+		CHECK(store._retired.count() == 1);
+		second.release();
+		third.release();
+		store.collect();
+		CHECK(store._retired.empty());
+	}
+
+	SECTION("columnar tables")
+	{
+		Dynamic_Array<i32> ids;
+		Dynamic_Array<r32> prices;
+		Dynamic_Array<u64> stock;
+		for(u32 i = 0; i < 1001; ++i)
+		{
+			ids.insert_back(i32(i) - 500);
+			prices.insert_back(r32(i) * 0.5f);
+			stock.insert_back(i % 10);
+		}
+
+		{
+			Dynamic_Array<Table_Column_Data> columns;
+			columns.insert_back(Table_Column_Data{ "id", COLUMN_TYPE::I32, &ids[0] });
+			columns.insert_back(Table_Column_Data{ "price", COLUMN_TYPE::F32, &prices[0] });
+			columns.insert_back(Table_Column_Data{ "stock", COLUMN_TYPE::U64, &stock[0] });
+
+			Pensieve pn;
+			auto handle = table_create(pn, "/items", columns, ids.count());
+			REQUIRE(handle.valid());
+			CHECK(file_is_table(pn, handle) == true);
+			CHECK(table_create(pn, "/items", columns, ids.count()).valid() == false);
+
+			Table table;
+			REQUIRE(table.open(pn, handle) == true);
+			CHECK(table.rows_count == 1001);
+			CHECK(table.column<i32>("id")[0] == -500);
+			CHECK(table.column<r32>("id").empty());
+
+			//the row indices are u32 so bigger tables are rejected
+			CHECK(table_create(pn, "/huge", Dynamic_Array<Table_Column_Data>(), Table::MAX_ROWS_COUNT + 1).valid() == false);
+			auto huge = pn.file_create("/huge");
+			u32 prefix[4] = { Table::TABLE_MAGIC, 0, 0, 1 };
+			pn.file_write(huge, prefix, 4);
+			pn.header.files[huge.header_entry_index].flags |= ENTRY_FLAG_TABLE;
+			Table huge_table;
+			CHECK(huge_table.open(pn, huge) == false);
+			pn.file_remove(huge);
+
+			//a columns count the schema can't hold is rejected before anything is allocated for it
+			auto wide = pn.file_create("/wide");
+			u32 wide_prefix[4] = { Table::TABLE_MAGIC, 0xFFFFFFFF, 0, 0 };
+			pn.file_write(wide, wide_prefix, 4);
+			pn.header.files[wide.header_entry_index].flags |= ENTRY_FLAG_TABLE;
+			Table wide_table;
+			CHECK(wide_table.open(pn, wide) == false);
+			pn.file_remove(wide);
+			CHECK(pn.save_on_disk("unittest_table.pnsv") == true);
+		}
+
+		{
+			Pensieve pn;
+			CHECK(pn.mount_from_disk("unittest_table.pnsv") == Pensieve::ERROR_OK);
+			auto handle = pn.file_open("/items");
+			CHECK(file_is_table(pn, handle) == true);
+
+			Table table;
+			REQUIRE(table.open(pn, handle) == true);
+			REQUIRE(table.columns.count() == 3);
+			CHECK(table.column_find("stock") == 2);
+
+			//only the used columns are read from the disk
+			auto price = table.column<r32>("price");
+			REQUIRE(price.count == 1001);
+			CHECK(table._loaded[0].ptr == nullptr);
+			CHECK(pn.content[pn.header.files[handle.header_entry_index].index].lazy == true);
+			CHECK(column_sum(price) == 0.5 * 1000 * 1001 / 2);
+
+			Dynamic_Array<u32> rows;
+			column_filter(price, SCAN_OP::GREATER_EQUAL, 400.0f, rows);
+			CHECK(rows.count() == 201);
+			CHECK(rows[0] == 800);
+
+			auto id = table.column<i32>("id");
+			rows.clear();
+			column_filter(id, SCAN_OP::LESS, -498, rows);
+			CHECK(rows.count() == 2);
+
+			rows.clear();
+			column_filter(id, SCAN_OP::NOT_EQUAL, 0, rows);
+			CHECK(rows.count() == 1000);
+			column_refine(table.column<u64>("stock"), SCAN_OP::EQUAL, 3, rows);
+			CHECK(rows.count() == 100);
+			CHECK(column_sum(table.column<u64>("stock"), rows) == 300);
+			CHECK(column_sum(id, rows) == -200);
+		}
+		::remove("unittest_table.pnsv");
+	}
+
+	SECTION("archive patches")
+	{
+		Dynamic_Array<u32> data;
+		u32 seed = 17;
+		for(u32 i = 0; i < 64 * 1024; ++i)
+		{
+			seed = seed * 1664525 + 1013904223;
+			data.insert_back(seed);
+		}
+
+		{
+			Pensieve pn;
+			pn.file_write(pn.file_create("/kept"), "kept content", 12);
+			pn.file_write(pn.file_create("/moved"), &data[0], 1024);
+			pn.file_write(pn.file_create("/modified"), &data[0], data.count());
+			pn.file_write(pn.file_create("/removed"), "removed content", 15);
+			CHECK(pn.save_on_disk("unittest_patch_old.pnsv") == true);
+
+			pn.file_remove(pn.file_open("/removed"));
+			pn.file_remove(pn.file_open("/moved"));
+			pn.file_write(pn.file_create("/renamed"), &data[0], 1024);
+			pn.file_write(pn.file_create("/added"), "added content", 13);
+
+			//a few values change in the middle and some are inserted near the end
+			auto handle = pn.file_open("/modified");
+			data[30000] = 0;
+			data[30001] = 1;
+			data.insert_back(7);
+			data.insert_back(8);
+			pn.file_clear(handle);
+			pn.file_write(handle, &data[0], 50000);
+			pn.file_write(handle, &data[data.count() - 2], 2);
+			pn.file_write(handle, &data[50000], data.count() - 50002);
+			pn.file_set_mtime(handle, 1600000000);
+			pn.file_set_tags(handle, "changed");
+			CHECK(pn.save_on_disk("unittest_patch_new.pnsv") == true);
+		}
+
+		Delta_Stats stats{};
+		REQUIRE(archive_diff("unittest_patch_old.pnsv", "unittest_patch_new.pnsv", "unittest_patch.pnsvp", &stats) == true);
+		CHECK(stats.kept == 1);
+		CHECK(stats.copied == 1);
+		CHECK(stats.added == 1);
+		CHECK(stats.deltas == 1);
+		CHECK(stats.reused_bytes > 200 * 1024);
+		CHECK(stats.literal_bytes < 16 * 1024);
+
+		REQUIRE(archive_patch("unittest_patch_old.pnsv", "unittest_patch.pnsvp", "unittest_patch_result.pnsv") == true);
+		{
+			Pensieve expected, result;
+			REQUIRE(expected.load_from_disk("unittest_patch_new.pnsv") == Pensieve::ERROR_OK);
+			REQUIRE(result.load_from_disk("unittest_patch_result.pnsv") == Pensieve::ERROR_OK);
+			CHECK(result.file_open("/removed").valid() == false);
+			CHECK(result.file_open("/moved").valid() == false);
+
+			const char* names[] = { "/kept", "/renamed", "/modified", "/added" };
+			for(const char* name: names)
+			{
+				auto a = expected.file_view<byte>(expected.file_open(name));
+				auto b = result.file_view<byte>(result.file_open(name));
+				REQUIRE(a.count == b.count);
+				CHECK(::memcmp(a.ptr, b.ptr, a.count) == 0);
+			}
+
+			auto stat = result.file_stat(result.file_open("/modified"));
+			CHECK(stat.mtime == 1600000000);
+			REQUIRE(stat.tags.bytes.size == 7);
+			CHECK(::memcmp(stat.tags.bytes.ptr, "changed", 7) == 0);
+		}
+
+		//the patch only applies on the archive it was made from
+		CHECK(archive_patch("unittest_patch_new.pnsv", "unittest_patch.pnsvp", "unittest_patch_result.pnsv") == false);
+
+		//an old archive whose chunks changed under the same header gives another new archive, which fails the checksum
+		FILE* f = ::fopen("unittest_patch_old.pnsv", "r+b");
+		REQUIRE(f != nullptr);
+		::fseek(f, -1, SEEK_END);
+		int last = ::fgetc(f);
+		::fseek(f, -1, SEEK_END);
+		::fputc(last ^ 0xFF, f);
+		::fclose(f);
+		CHECK(archive_patch("unittest_patch_old.pnsv", "unittest_patch.pnsvp", "unittest_patch_result.pnsv") == false);
+		CHECK(::fopen("unittest_patch_result.pnsv", "rb") == nullptr);
+		CHECK(::fopen("unittest_patch_result.pnsv.spool", "rb") == nullptr);
+
+		::remove("unittest_patch_old.pnsv");
+		::remove("unittest_patch_new.pnsv");
+		::remove("unittest_patch.pnsvp");
+		::remove("unittest_patch_result.pnsv");
+	}
+
+	SECTION("thread pool and async operations")
+	{
+		Thread_Pool_Config config{};
+		config.workers_count = 4;
+		Thread_Pool pool(config);
+		CHECK(pool.workers_count() == 4);
+
+		std::atomic<usize> counter(0);
+		Task_Group group;
+		for(usize i = 0; i < 100; ++i)
+			pool.submit(group, [](void* user_data){ ++*static_cast<std::atomic<usize>*>(user_data); }, &counter);
+		pool.wait(group);
+		CHECK(counter.load() == 100);
+
+		thread_pool_set(&pool);
+		{
+			//big enough for the chunks to be read in multiple spans
+			Dynamic_Array<u32> data;
+			for(u32 i = 0; i < 256 * 1024; ++i)
+				data.insert_back(i);
+
+			Pensieve pn;
+			for(u32 i = 0; i < 20; ++i)
+			{
+				data[0] = i;
+				char name[32];
+				snprintf(name, sizeof(name), "/file_%u", i);
+				pn.file_write(pn.file_create(name), &data[0], data.count());
+			}
+
+			usize calls = 0;
+			Pensieve_Task task([](Pensieve*, bool ok, void* user_data){
+				if(ok)
+					++*static_cast<usize*>(user_data);
+			}, &calls);
+			pn.save_on_disk_async(task, "unittest_async.pnsv");
+			CHECK(task.wait() == Pensieve::ERROR_OK);
+			CHECK(task.is_done() == true);
+
+			Pensieve loaded;
+			loaded.load_from_disk_async(task, "unittest_async.pnsv");
+			CHECK(task.wait() == Pensieve::ERROR_OK);
+			CHECK(calls == 2);
+			REQUIRE(loaded.header.files.count() == 20);
+			auto view = loaded.file_view<u32>(loaded.file_open("/file_7"));
+			REQUIRE(view.count == data.count());
+			CHECK(view[0] == 7);
+			CHECK(view[1000] == 1000);
+
+			Pensieve mounted;
+			CHECK(mounted.mount_from_disk("unittest_async.pnsv") == Pensieve::ERROR_OK);
+			mounted.verify_async(task);
+			CHECK(task.wait() == Pensieve::ERROR_OK);
+			CHECK(calls == 3);
+
+			//a chunk which size doesn't match the header fails the verification
+			const auto& c = mounted.content[mounted.header.files[mounted.file_open("/file_3").header_entry_index].index];
+			FILE* f = ::fopen("unittest_async.pnsv", "r+b");
+			REQUIRE(f != nullptr);
+			u64 wrong_size = 5;
+			::fseek(f, long(mounted.data_offset + c.offset), SEEK_SET);
+			::fwrite(&wrong_size, sizeof(wrong_size), 1, f);
+			::fclose(f);
+			CHECK(mounted.verify() == Pensieve::ERROR_FILE_CORRUPTED);
+		}
+
+		{
+			//the only worker is busy so the load is still queued when it's cancelled
+			Thread_Pool_Config single{};
+			single.workers_count = 1;
+			Thread_Pool busy_pool(single);
+			thread_pool_set(&busy_pool);
+
+			std::atomic<bool> release(false);
+			Task_Group busy;
+			busy_pool.submit(busy, [](void* user_data){
+				while(static_cast<std::atomic<bool>*>(user_data)->load() == false)
+					std::this_thread::yield();
+			}, &release);
+
+			Pensieve pn;
+			Pensieve_Task task;
+			pn.load_from_disk_async(task, "unittest_async.pnsv");
+			task.cancel();
+			release.store(true);
+			CHECK(task.wait() == Pensieve::ERROR_CANCELLED);
+			CHECK(pn.header.files.count() == 0);
+			busy_pool.wait(busy);
+
+			//waiting from the only worker runs the operation tasks instead of blocking it
+			struct Nested
+			{
+				Pensieve pn;
+				Pensieve_Task task;
+				Pensieve::ERROR_CODE err;
+				std::atomic<bool> finished;
+			};
+			Nested nested;
+			nested.err = Pensieve::ERROR_OK;
+			nested.finished.store(false);
+			Task_Group outer;
+			busy_pool.submit(outer, [](void* user_data){
+				Nested* n = static_cast<Nested*>(user_data);
+				n->pn.load_from_disk_async(n->task, "unittest_async.pnsv");
+				n->err = n->task.wait();
+				n->finished.store(true);
+			}, &nested);
+			while(nested.finished.load() == false)
+				std::this_thread::yield();
+			busy_pool.wait(outer);
+
+			//the archive was corrupted above so the load fails and drops its entries
+			CHECK(nested.err == Pensieve::ERROR_FILE_CORRUPTED);
+			CHECK(nested.pn.header.files.count() == 0);
+			CHECK(nested.pn.disk.valid() == false);
+			thread_pool_set(&pool);
+		}
+
+		{
+			//a load into a mounted archive gives the file back to it
+			Dynamic_Array<u32> data;
+			for(u32 i = 0; i < 16 * 1024; ++i)
+				data.insert_back(i);
+			{
+				Pensieve pn;
+				pn.file_write(pn.file_create("/mounted"), &data[0], data.count());
+				CHECK(pn.save_on_disk("unittest_async_mounted.pnsv") == true);
+			}
+
+			Block_Cache cache(4 * 4096, 4096);
+			Pensieve pn;
+			pn.cache = &cache;
+			REQUIRE(pn.mount_from_disk("unittest_async_mounted.pnsv") == Pensieve::ERROR_OK);
+			u32 value = 0;
+			Slice<byte> value_data{ (byte*)&value, sizeof(value) };
+			CHECK(pn.file_read(pn.file_open("/mounted"), 0, value_data) == sizeof(value));
+			usize blocks_count = cache.stats().blocks_count;
+			CHECK(blocks_count > 0);
+			u64 id = pn.archive_id;
+
+			Pensieve_Task task;
+			pn.load_from_disk_async(task, "unittest_async.pnsv");
+			CHECK(task.wait() == Pensieve::ERROR_FILE_CORRUPTED);
+			CHECK(pn.header.files.count() == 1);
+			CHECK(pn.disk.valid() == true);
+			//the mount keeps its id and cached blocks
+			CHECK(pn.archive_id == id);
+			CHECK(cache.stats().blocks_count == blocks_count);
+			auto view = pn.file_view<u32>(pn.file_open("/mounted"));
+			REQUIRE(view.count == data.count());
+			CHECK(view[1000] == 1000);
+		}
+		::remove("unittest_async_mounted.pnsv");
+		thread_pool_set(nullptr);
+		::remove("unittest_async.pnsv");
 	}
 }